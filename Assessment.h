@@ -0,0 +1,423 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Database.h"
+
+struct WordAssessment {
+  std::string_view word;
+  std::string_view errorType;
+  double accuracy = 0;
+  uint64_t offset = 0;   // 100ns ticks from the start of the audio
+  uint64_t duration = 0; // 100ns ticks
+};
+
+struct PhonemeAssessment {
+  std::string_view phoneme;
+  double accuracy = 0;
+};
+
+// Bump allocator that keeps its blocks when rewound, so whatever is built in
+// it next reuses memory it already owns. Deallocation is a no-op; rewind()
+// gives everything back at once.
+class Arena : public std::pmr::memory_resource {
+public:
+  Arena() = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void rewind() {
+    block_ = 0;
+    used_ = 0;
+  }
+
+private:
+  struct Block {
+    std::unique_ptr<std::byte[]> data;
+    size_t size;
+  };
+
+  std::byte *base(size_t i) {
+    return i == 0 ? inline_.data() : blocks_[i - 1].data.get();
+  }
+  size_t capacity(size_t i) const {
+    return i == 0 ? inline_.size() : blocks_[i - 1].size;
+  }
+
+  void *do_allocate(size_t bytes, size_t align) override {
+    while (true) {
+      uintptr_t start = reinterpret_cast<uintptr_t>(base(block_));
+      uintptr_t aligned = (start + used_ + align - 1) & ~(uintptr_t{align} - 1);
+      size_t offset = aligned - start;
+      if (offset + bytes <= capacity(block_)) {
+        used_ = offset + bytes;
+        return base(block_) + offset;
+      }
+      // Only the first pass over a larger response gets here.
+      if (block_ == blocks_.size()) {
+        size_t size = std::max(capacity(block_) * 2, bytes + align);
+        blocks_.push_back({std::unique_ptr<std::byte[]>(new std::byte[size]),
+                           size});
+      }
+      block_++;
+      used_ = 0;
+    }
+  }
+
+  void do_deallocate(void *, size_t, size_t) override {}
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    return this == &other;
+  }
+
+  alignas(std::max_align_t) std::array<std::byte, 4096> inline_;
+  std::vector<Block> blocks_; // the blocks after inline_, in use order
+  size_t block_ = 0;          // 0 is inline_, i is blocks_[i - 1]
+  size_t used_ = 0;
+};
+
+// Flat view of a detailed pronunciation assessment response. Only the fields
+// we actually report are kept; the containers and every string live in the
+// result's own arena, which is rewound rather than freed by clear(). A result
+// reused for responses no larger than ones it has already held allocates
+// nothing from the heap.
+class AssessmentResult {
+  // Declared first so the arena outlives the containers that allocate from it.
+  Arena arena_;
+
+public:
+  std::string_view recognitionStatus;
+  double accuracy = 0;
+  double fluency = 0;
+  double completeness = 0;
+  double prosody = 0;
+  double pronunciation = 0;
+  std::pmr::vector<WordAssessment> words{&arena_};
+  // Every phoneme of every word, in order; only the top candidate is kept.
+  std::pmr::vector<PhonemeAssessment> phonemes{&arena_};
+
+  AssessmentResult() = default;
+  AssessmentResult(const AssessmentResult &) = delete;
+  AssessmentResult &operator=(const AssessmentResult &) = delete;
+
+  void clear() {
+    recognitionStatus = {};
+    accuracy = fluency = completeness = prosody = pronunciation = 0;
+    // The vectors' buffers are arena memory about to be reused, so they are
+    // dropped rather than cleared.
+    std::pmr::vector<WordAssessment>(&arena_).swap(words);
+    std::pmr::vector<PhonemeAssessment>(&arena_).swap(phonemes);
+    arena_.rewind();
+  }
+
+  std::string_view store(const std::string &s) {
+    char *p = static_cast<char *>(arena_.allocate(s.size(), 1));
+    std::memcpy(p, s.data(), s.size());
+    return {p, s.size()};
+  }
+};
+
+namespace assessment {
+
+// SAX handler that walks the response once and copies the interesting
+// fields out of the first NBest entry. Scores are accepted both directly on
+// the NBest/word objects and nested under "PronunciationAssessment", since
+// the service has shipped both shapes.
+class Extractor : public nlohmann::json_sax<nlohmann::json> {
+public:
+  explicit Extractor(AssessmentResult &out) : out_(out) {}
+
+  bool null() override { return value(); }
+  bool boolean(bool) override { return value(); }
+  bool number_integer(number_integer_t v) override {
+    return number(static_cast<double>(v));
+  }
+  bool number_unsigned(number_unsigned_t v) override {
+    return number(static_cast<double>(v));
+  }
+  bool number_float(number_float_t v, const string_t &) override {
+    return number(v);
+  }
+  bool binary(binary_t &) override { return value(); }
+
+  bool string(string_t &v) override {
+    switch (field_) {
+    case Field::RecognitionStatus:
+      out_.recognitionStatus = out_.store(v);
+      break;
+    case Field::Word:
+      out_.words.back().word = out_.store(v);
+      break;
+    case Field::ErrorType:
+      out_.words.back().errorType = out_.store(v);
+      break;
+    case Field::Phoneme:
+      out_.phonemes.back().phoneme = out_.store(v);
+      break;
+    default:
+      break;
+    }
+    return value();
+  }
+
+  bool start_object(std::size_t) override {
+    Scope parent = top();
+    Scope scope = Scope::Skip;
+    if (parent == Scope::NBestList && nbestSeen_++ == 0) {
+      scope = Scope::NBest;
+    } else if (parent == Scope::WordList) {
+      out_.words.emplace_back();
+      scope = Scope::Word;
+    } else if (parent == Scope::PhonemeList) {
+      out_.phonemes.emplace_back();
+      scope = Scope::Phoneme;
+    } else if (field_ == Field::PronunciationAssessment) {
+      scope = parent == Scope::NBest     ? Scope::NBestScores
+              : parent == Scope::Word    ? Scope::WordScores
+              : parent == Scope::Phoneme ? Scope::PhonemeScores
+                                         : Scope::Skip;
+    } else if (parent == Scope::None) {
+      scope = Scope::Root;
+    }
+    return push(scope);
+  }
+
+  bool end_object() override { return pop(); }
+
+  bool start_array(std::size_t) override {
+    Scope scope = Scope::Skip;
+    if (field_ == Field::NBest) {
+      scope = Scope::NBestList;
+    } else if (field_ == Field::Words) {
+      scope = Scope::WordList;
+    } else if (field_ == Field::Phonemes) {
+      scope = Scope::PhonemeList;
+    }
+    return push(scope);
+  }
+
+  bool end_array() override { return pop(); }
+
+  bool key(string_t &k) override {
+    field_ = classify(top(), k);
+    return true;
+  }
+
+  bool parse_error(std::size_t, const std::string &,
+                   const nlohmann::detail::exception &) override {
+    return false;
+  }
+
+private:
+  enum class Scope : uint8_t {
+    None,
+    Root,
+    NBestList,
+    NBest,
+    NBestScores,
+    WordList,
+    Word,
+    WordScores,
+    PhonemeList,
+    Phoneme,
+    PhonemeScores,
+    Skip
+  };
+
+  enum class Field : uint8_t {
+    Other,
+    RecognitionStatus,
+    NBest,
+    PronunciationAssessment,
+    Words,
+    Word,
+    Phonemes,
+    Phoneme,
+    ErrorType,
+    Offset,
+    Duration,
+    AccuracyScore,
+    FluencyScore,
+    CompletenessScore,
+    ProsodyScore,
+    PronScore
+  };
+
+  static constexpr std::size_t kMaxDepth = 64;
+
+  AssessmentResult &out_;
+  std::array<Scope, kMaxDepth> stack_{};
+  std::size_t depth_ = 0;
+  std::size_t nbestSeen_ = 0;
+  Field field_ = Field::Other;
+
+  Scope top() const { return depth_ ? stack_[depth_ - 1] : Scope::None; }
+
+  bool push(Scope scope) {
+    if (depth_ == kMaxDepth) {
+      return false;
+    }
+    stack_[depth_++] = scope;
+    field_ = Field::Other;
+    return true;
+  }
+
+  bool pop() {
+    --depth_;
+    field_ = Field::Other;
+    return true;
+  }
+
+  bool value() {
+    field_ = Field::Other;
+    return true;
+  }
+
+  static Field classify(Scope scope, std::string_view k) {
+    switch (scope) {
+    case Scope::Root:
+      if (k == "RecognitionStatus")
+        return Field::RecognitionStatus;
+      if (k == "NBest")
+        return Field::NBest;
+      break;
+    case Scope::NBest:
+      if (k == "Words")
+        return Field::Words;
+      if (k == "PronunciationAssessment")
+        return Field::PronunciationAssessment;
+      [[fallthrough]];
+    case Scope::NBestScores:
+      if (k == "AccuracyScore")
+        return Field::AccuracyScore;
+      if (k == "FluencyScore")
+        return Field::FluencyScore;
+      if (k == "CompletenessScore")
+        return Field::CompletenessScore;
+      if (k == "ProsodyScore")
+        return Field::ProsodyScore;
+      if (k == "PronScore")
+        return Field::PronScore;
+      break;
+    case Scope::Word:
+      if (k == "Word")
+        return Field::Word;
+      if (k == "Offset")
+        return Field::Offset;
+      if (k == "Duration")
+        return Field::Duration;
+      if (k == "Phonemes")
+        return Field::Phonemes;
+      if (k == "PronunciationAssessment")
+        return Field::PronunciationAssessment;
+      [[fallthrough]];
+    case Scope::WordScores:
+      if (k == "AccuracyScore")
+        return Field::AccuracyScore;
+      if (k == "ErrorType")
+        return Field::ErrorType;
+      break;
+    case Scope::Phoneme:
+      if (k == "Phoneme")
+        return Field::Phoneme;
+      if (k == "PronunciationAssessment")
+        return Field::PronunciationAssessment;
+      [[fallthrough]];
+    case Scope::PhonemeScores:
+      if (k == "AccuracyScore")
+        return Field::AccuracyScore;
+      break;
+    default:
+      break;
+    }
+    return Field::Other;
+  }
+
+  // Offsets and durations are 100 ns ticks, exact in a double well past any
+  // recording length. Anything negative or out of range reads as 0.
+  static uint64_t ticks(double d) {
+    return d >= 0 && d < 18446744073709551616.0 ? static_cast<uint64_t>(d) : 0;
+  }
+
+  bool number(double d) {
+    Scope scope = top();
+    switch (field_) {
+    case Field::AccuracyScore:
+      if (scope == Scope::Phoneme || scope == Scope::PhonemeScores) {
+        out_.phonemes.back().accuracy = d;
+      } else if (scope == Scope::Word || scope == Scope::WordScores) {
+        out_.words.back().accuracy = d;
+      } else {
+        out_.accuracy = d;
+      }
+      break;
+    case Field::FluencyScore:
+      out_.fluency = d;
+      break;
+    case Field::CompletenessScore:
+      out_.completeness = d;
+      break;
+    case Field::ProsodyScore:
+      out_.prosody = d;
+      break;
+    case Field::PronScore:
+      out_.pronunciation = d;
+      break;
+    case Field::Offset:
+      out_.words.back().offset = ticks(d);
+      break;
+    case Field::Duration:
+      out_.words.back().duration = ticks(d);
+      break;
+    default:
+      break;
+    }
+    return value();
+  }
+};
+
+// Parses a detailed recognition response into `out`, replacing whatever it
+// held before. Returns false if the body is not valid JSON.
+inline bool parse(std::string_view body, AssessmentResult &out) {
+  TRACE_SPAN("assessment.parse");
+  out.clear();
+  Extractor extractor(out);
+  return nlohmann::json::sax_parse(body.begin(), body.end(), &extractor);
+}
+
+// Flattens a parsed result into the row shape the database stores.
+inline AssessmentRecord toRecord(const AssessmentResult &result,
+                                 const std::string &username,
+                                 const std::string &referenceText) {
+  AssessmentRecord record;
+  record.username = username;
+  record.referenceText = referenceText;
+  record.accuracy = result.accuracy;
+  record.fluency = result.fluency;
+  record.completeness = result.completeness;
+  record.prosody = result.prosody;
+  record.pronunciation = result.pronunciation;
+  record.wordCount = static_cast<int>(result.words.size());
+  for (const WordAssessment &word : result.words) {
+    if (!word.errorType.empty() && word.errorType != "None") {
+      record.errorCount++;
+    }
+  }
+  record.phonemes.reserve(result.phonemes.size());
+  for (const PhonemeAssessment &p : result.phonemes) {
+    record.phonemes.push_back({std::string(p.phoneme), p.accuracy});
+  }
+  return record;
+}
+
+} // namespace assessment
@@ -0,0 +1,656 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Assessment.h"
+#include "Database.h"
+#include "Speech.h"
+#include "Trace.h"
+
+// Grades a manifest of recordings in one process. Every item goes through
+// read -> convert -> upload -> parse -> persist. Each stage has its own
+// concurrency limit, and one pool of workers runs whichever stage has room.
+// A worker queues an item's next stage on its own deque and steals from the
+// other workers when it has nothing runnable. Finished items are recorded in
+// the database in the same transaction as their results, so a rerun after a
+// crash skips exactly the items whose results were kept.
+
+namespace batch {
+
+struct Item {
+  std::string audioPath;
+  std::string referenceText;
+  std::string username;
+  size_t line = 0;
+  // The manifest line; identifies the item among those already done.
+  std::string key;
+};
+
+// One item per line: audio path, reference text and username separated by
+// tabs. Blank lines and lines starting with '#' are skipped. Relative audio
+// paths are resolved against the manifest's directory. A repeated line is an
+// error: it would share its key with the first, so resuming could not tell
+// them apart.
+inline std::vector<Item> loadManifest(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("Manifest not found: " + path);
+  }
+  size_t slash = path.rfind('/');
+  std::string dir = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+
+  std::vector<Item> items;
+  std::unordered_map<std::string, size_t> seen; // line -> line number
+  std::string line;
+  for (size_t n = 1; std::getline(file, line); n++) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    size_t first = line.find('\t');
+    size_t second =
+        first == std::string::npos ? first : line.find('\t', first + 1);
+    if (second == std::string::npos ||
+        line.find('\t', second + 1) != std::string::npos || first == 0 ||
+        second + 1 == line.size()) {
+      throw std::runtime_error(
+          path + ":" + std::to_string(n) +
+          ": expected audio path<TAB>reference text<TAB>username");
+    }
+
+    auto [it, added] = seen.emplace(line, n);
+    if (!added) {
+      throw std::runtime_error(path + ":" + std::to_string(n) +
+                               ": duplicate of line " +
+                               std::to_string(it->second));
+    }
+
+    Item item;
+    item.audioPath = line.substr(0, first);
+    if (item.audioPath[0] != '/') {
+      item.audioPath = dir + item.audioPath;
+    }
+    item.referenceText = line.substr(first + 1, second - first - 1);
+    item.username = line.substr(second + 1);
+    item.line = n;
+    item.key = line;
+    items.push_back(std::move(item));
+  }
+  return items;
+}
+
+// Read-only mapping of a whole file.
+class MappedFile {
+public:
+  MappedFile() = default;
+
+  explicit MappedFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Cannot open " + path + ": " + strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      ::close(fd);
+      throw std::runtime_error("Empty or unreadable file: " + path);
+    }
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      throw std::runtime_error("Cannot map " + path + ": " + strerror(errno));
+    }
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    data_ = static_cast<const uint8_t *>(p);
+    size_ = st.st_size;
+  }
+
+  ~MappedFile() { reset(); }
+
+  MappedFile(MappedFile &&other) noexcept
+      : data_(other.data_), size_(other.size_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+  }
+
+  MappedFile &operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+      reset();
+      std::swap(data_, other.data_);
+      std::swap(size_, other.size_);
+    }
+    return *this;
+  }
+
+  void reset() {
+    if (data_) {
+      munmap(const_cast<uint8_t *>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  const uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+inline uint32_t readLE(const uint8_t *p, int bytes) {
+  uint32_t value = 0;
+  for (int i = bytes - 1; i >= 0; i--) {
+    value = value << 8 | p[i];
+  }
+  return value;
+}
+
+// True if `data` is a WAV file, after checking it is 16 kHz 16-bit mono PCM
+// (the only format the service is sent; resampling is not done here).
+inline bool isWav(const uint8_t *data, size_t size) {
+  if (size < 12 || std::memcmp(data, "RIFF", 4) != 0 ||
+      std::memcmp(data + 8, "WAVE", 4) != 0) {
+    return false;
+  }
+  for (size_t pos = 12; pos + 8 <= size;) {
+    uint32_t chunkSize = readLE(data + pos + 4, 4);
+    if (std::memcmp(data + pos, "fmt ", 4) == 0 && pos + 24 <= size) {
+      const uint8_t *fmt = data + pos + 8;
+      if (readLE(fmt, 2) != 1 || readLE(fmt + 2, 2) != 1 ||
+          readLE(fmt + 4, 4) != 16000 || readLE(fmt + 14, 2) != 16) {
+        throw std::runtime_error("Unsupported WAV format, need 16 kHz 16-bit "
+                                 "mono PCM");
+      }
+      return true;
+    }
+    pos += 8 + chunkSize + (chunkSize & 1);
+  }
+  throw std::runtime_error("WAV file has no fmt chunk");
+}
+
+enum Stage { Read, Convert, Upload, Parse, Persist, kStageCount };
+
+inline const char *stageName(int stage) {
+  static const char *names[kStageCount] = {"read", "convert", "upload",
+                                           "parse", "persist"};
+  return names[stage];
+}
+
+struct Options {
+  // Per-stage concurrency. Persist always runs alone, since SQLite takes one
+  // writer at a time; it commits whatever has queued up in one transaction.
+  int readers = 2;
+  int converters = 2;
+  int uploads = 8;
+  int parsers = 2;
+  // Workers shared by the stages. 0 means uploads plus one per core, so
+  // workers blocked on uploads never starve the CPU-bound stages.
+  int workers = 0;
+  // Items started but not yet persisted. Bounds the mapped audio and the
+  // buffered responses held at once.
+  size_t maxInFlight = 64;
+  size_t persistBatch = 32;
+  size_t uploadChunk = 64 * 1024;
+  // Upload attempts per item before it fails, for errors worth retrying
+  // (network errors, 429 and 5xx). Calls the circuit breaker turns away are
+  // not attempts; they wait for it to let a probe through.
+  int maxAttempts = 3;
+  // Delay before the second attempt, doubled for each one after.
+  long retryDelayMs = 500;
+  std::string region = "eastus";
+  std::string locale = "en-US";
+  std::string subscriptionKey;
+  UpstreamPolicy policy = UpstreamPolicy::fromEnv();
+};
+
+struct StageStats {
+  size_t runs = 0;
+  double busyMs = 0;
+};
+
+struct Report {
+  size_t items = 0;
+  size_t skipped = 0; // finished by an earlier run
+  size_t graded = 0;
+  size_t failed = 0;
+  int workers = 0;
+  double wallSeconds = 0;
+  StageStats stages[kStageCount];
+
+  double itemsPerMinute() const {
+    return wallSeconds > 0 ? graded * 60.0 / wallSeconds : 0;
+  }
+};
+
+class Pipeline {
+public:
+  // `batch` names the run in the database; items it already finished are
+  // skipped.
+  Pipeline(std::vector<Item> items, Database &db, std::string batch,
+           Options options)
+      : items_(std::move(items)), db_(db), batch_(std::move(batch)),
+        options_(std::move(options)), state_(items_.size()) {
+    std::unordered_set<std::string> done = db_.batchDone(batch_);
+    for (size_t i = 0; i < items_.size(); i++) {
+      if (!done.count(items_[i].key)) {
+        pending_.push_back(i);
+      }
+    }
+    int limits[kStageCount] = {options_.readers, options_.converters,
+                               options_.uploads, options_.parsers, 1};
+    for (int s = 0; s < kStageCount; s++) {
+      limits_[s] = std::max(limits[s], 1);
+    }
+    int workers = options_.workers;
+    if (workers <= 0) {
+      workers = limits_[Upload] +
+                static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    for (int i = 0; i < workers; i++) {
+      workers_.push_back(std::make_unique<Worker>());
+    }
+  }
+
+  // Grades every item not already done. Items that fail are reported on
+  // stderr and not recorded as done, so a rerun retries them.
+  Report run() {
+    report_.items = items_.size();
+    report_.skipped = items_.size() - pending_.size();
+    report_.workers = static_cast<int>(workers_.size());
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers_.size(); i++) {
+      threads.emplace_back([this, i] { workerLoop(static_cast<int>(i)); });
+    }
+    for (std::thread &t : threads) {
+      t.join();
+    }
+    report_.wallSeconds = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    return report_;
+  }
+
+private:
+  struct Task {
+    size_t item;
+    int stage;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // Per-item data handed from stage to stage. Only one stage works on an
+  // item at a time, and the hand-off goes through a deque's mutex.
+  struct ItemState {
+    MappedFile audio;
+    std::vector<uint8_t> wav;
+    const uint8_t *upload = nullptr;
+    size_t uploadSize = 0;
+    std::string body;
+    AssessmentRecord record;
+    int attempts = 0;
+  };
+
+  using Clock = std::chrono::steady_clock;
+
+  bool tryAcquire(int stage) {
+    int busy = busy_[stage].load(std::memory_order_relaxed);
+    while (busy < limits_[stage]) {
+      if (busy_[stage].compare_exchange_weak(busy, busy + 1)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool done() const {
+    return cursor_.load() >= pending_.size() && inFlight_.load() == 0;
+  }
+
+  void push(int self, Task task) {
+    Worker &w = *workers_[self];
+    std::lock_guard<std::mutex> lock(w.mutex);
+    w.tasks.push_back(task);
+  }
+
+  // Takes a task whose stage has a free slot: the newest one of this
+  // worker's own deque, which finishes started items first, then the oldest
+  // one of another worker's, then a new item from the manifest.
+  bool nextTask(int self, Task &task) {
+    auto take = [&](Worker &w, bool newestFirst) {
+      std::lock_guard<std::mutex> lock(w.mutex);
+      for (size_t n = 0; n < w.tasks.size(); n++) {
+        size_t i = newestFirst ? w.tasks.size() - 1 - n : n;
+        if (tryAcquire(w.tasks[i].stage)) {
+          task = w.tasks[i];
+          w.tasks.erase(w.tasks.begin() + i);
+          return true;
+        }
+      }
+      return false;
+    };
+
+    if (take(*workers_[self], true)) {
+      return true;
+    }
+    for (size_t n = 1; n < workers_.size(); n++) {
+      if (take(*workers_[(self + n) % workers_.size()], false)) {
+        return true;
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(retryMutex_);
+      if (!retries_.empty() && retries_.begin()->first <= Clock::now() &&
+          tryAcquire(Upload)) {
+        task = {retries_.begin()->second, Upload};
+        retries_.erase(retries_.begin());
+        return true;
+      }
+    }
+
+    if (cursor_.load() >= pending_.size()) {
+      return false;
+    }
+    if (inFlight_.fetch_add(1) >= options_.maxInFlight) {
+      inFlight_--;
+      return false;
+    }
+    if (tryAcquire(Read)) {
+      size_t next = cursor_.fetch_add(1);
+      if (next < pending_.size()) {
+        task = {pending_[next], Read};
+        return true;
+      }
+      busy_[Read]--;
+    }
+    inFlight_--;
+    return false;
+  }
+
+  void notify() {
+    {
+      std::lock_guard<std::mutex> lock(waitMutex_);
+      epoch_++;
+    }
+    wake_.notify_all();
+  }
+
+  void workerLoop(int self) {
+    while (true) {
+      uint64_t seen;
+      {
+        std::lock_guard<std::mutex> lock(waitMutex_);
+        seen = epoch_;
+      }
+      Task task;
+      if (nextTask(self, task)) {
+        runTask(self, task);
+        busy_[task.stage]--;
+        notify();
+        continue;
+      }
+      if (done()) {
+        notify();
+        return;
+      }
+      // A retry coming due wakes nobody, so sleep no later than the first.
+      // One already due is only waiting for an upload slot, and the upload
+      // that frees it notifies.
+      bool pending;
+      Clock::time_point due;
+      {
+        std::lock_guard<std::mutex> lock(retryMutex_);
+        pending = !retries_.empty() && retries_.begin()->first > Clock::now();
+        due = pending ? retries_.begin()->first : Clock::time_point();
+      }
+      std::unique_lock<std::mutex> lock(waitMutex_);
+      if (pending) {
+        wake_.wait_until(lock, due, [&] { return epoch_ != seen; });
+      } else {
+        wake_.wait(lock, [&] { return epoch_ != seen; });
+      }
+    }
+  }
+
+  void runTask(int self, const Task &task) {
+    static const char *traceNames[kStageCount] = {
+        "batch.read", "batch.convert", "batch.upload", "batch.parse",
+        "batch.persist"};
+    TRACE_REQUEST(traceNames[task.stage]);
+
+    auto start = std::chrono::steady_clock::now();
+    ItemState &state = state_[task.item];
+    const Item &item = items_[task.item];
+    bool ran = true;
+    try {
+      switch (task.stage) {
+      case Read:
+        state.audio = MappedFile(item.audioPath);
+        push(self, {task.item, Convert});
+        break;
+      case Convert:
+        convert(state);
+        push(self, {task.item, Upload});
+        break;
+      case Upload:
+        if (upload(task.item)) {
+          push(self, {task.item, Parse});
+        }
+        break;
+      case Parse:
+        parse(state, item);
+        {
+          std::lock_guard<std::mutex> lock(persistMutex_);
+          toPersist_.push_back(task.item);
+        }
+        push(self, {task.item, Persist});
+        break;
+      case Persist:
+        ran = persistQueued();
+        break;
+      }
+    } catch (const std::exception &e) {
+      fail(task.item, e.what());
+    }
+
+    if (ran) {
+      double ms = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+      std::lock_guard<std::mutex> lock(reportMutex_);
+      report_.stages[task.stage].runs++;
+      report_.stages[task.stage].busyMs += ms;
+    }
+  }
+
+  // WAV files in the right format are sent straight from the mapping; raw
+  // PCM gets the header prepended.
+  static void convert(ItemState &state) {
+    const uint8_t *data = state.audio.data();
+    size_t size = state.audio.size();
+    if (isWav(data, size)) {
+      state.upload = data;
+      state.uploadSize = size;
+      return;
+    }
+    state.wav.reserve(waveHeader16K16BitMono.size() + size);
+    state.wav.assign(waveHeader16K16BitMono.begin(),
+                     waveHeader16K16BitMono.end());
+    state.wav.insert(state.wav.end(), data, data + size);
+    state.audio.reset();
+    state.upload = state.wav.data();
+    state.uploadSize = state.wav.size();
+  }
+
+  // Returns false if the item was queued to be uploaded again later.
+  bool upload(size_t index) {
+    ItemState &state = state_[index];
+    const Item &item = items_[index];
+    PronunciationAssessmentParams params;
+    params.ReferenceText = item.referenceText;
+    std::string url = speech::sttUrl(options_.region, options_.locale,
+                                     speech::generateSessionID());
+    speech::AudioUpload audio{.data = state.upload,
+                              .size = state.uploadSize,
+                              .chunkSize = options_.uploadChunk};
+    speech::Response response = speech::assess(
+        url, options_.subscriptionKey, params, audio, options_.policy);
+
+    const UpstreamResult &call = response.call;
+    if (call.rejected) {
+      auto wait = Upstream::forUrl(url).breaker.retryAfter(options_.policy);
+      retryLater(index, std::max(wait, std::chrono::milliseconds(
+                                          options_.retryDelayMs)));
+      return false;
+    }
+    if (call.code != CURLE_OK || call.httpCode != 200) {
+      std::string error = call.code != CURLE_OK
+                              ? std::string("Request failed: ") +
+                                    curl_easy_strerror(call.code)
+                              : "HTTP " + std::to_string(call.httpCode);
+      if (++state.attempts >= options_.maxAttempts ||
+          !upstream::retryable(call.code, call.httpCode)) {
+        throw std::runtime_error(error + " (attempt " +
+                                 std::to_string(state.attempts) + ")");
+      }
+      retryLater(index, std::chrono::milliseconds(options_.retryDelayMs
+                                                 << (state.attempts - 1)));
+      return false;
+    }
+
+    state.audio.reset();
+    std::vector<uint8_t>().swap(state.wav);
+    state.upload = nullptr;
+    state.body = std::move(response.body);
+    return true;
+  }
+
+  // Queues an item for another upload once `delay` has passed. It stays in
+  // flight meanwhile, keeping its audio.
+  void retryLater(size_t index, std::chrono::milliseconds delay) {
+    std::lock_guard<std::mutex> lock(retryMutex_);
+    retries_.emplace(Clock::now() + delay, index);
+  }
+
+  static void parse(ItemState &state, const Item &item) {
+    static thread_local AssessmentResult result;
+    bool ok = assessment::parse(state.body, result);
+    std::string().swap(state.body);
+    if (!ok) {
+      throw std::runtime_error("Malformed response");
+    }
+    if (result.recognitionStatus != "Success") {
+      throw std::runtime_error("Recognition status: " +
+                               std::string(result.recognitionStatus));
+    }
+    state.record = assessment::toRecord(result, item.username,
+                                        item.referenceText);
+  }
+
+  // Commits up to persistBatch queued results, and marks their items done, in
+  // one transaction. Returns false if another persist already took them.
+  bool persistQueued() {
+    std::vector<size_t> batch;
+    {
+      std::lock_guard<std::mutex> lock(persistMutex_);
+      size_t n = std::min(toPersist_.size(), options_.persistBatch);
+      batch.assign(toPersist_.begin(), toPersist_.begin() + n);
+      toPersist_.erase(toPersist_.begin(), toPersist_.begin() + n);
+    }
+    if (batch.empty()) {
+      return false;
+    }
+
+    std::vector<AssessmentRecord> records;
+    std::vector<std::string> keys;
+    for (size_t i : batch) {
+      records.push_back(std::move(state_[i].record));
+      keys.push_back(items_[i].key);
+    }
+    try {
+      db_.addAssessments(records, batch_, keys);
+    } catch (const std::exception &e) {
+      for (size_t i : batch) {
+        fail(i, e.what());
+      }
+      return true;
+    }
+
+    for (size_t i : batch) {
+      state_[i] = ItemState();
+    }
+    {
+      std::lock_guard<std::mutex> lock(reportMutex_);
+      report_.graded += batch.size();
+    }
+    inFlight_ -= batch.size();
+    return true;
+  }
+
+  void fail(size_t index, const std::string &error) {
+    state_[index] = ItemState();
+    {
+      std::lock_guard<std::mutex> lock(reportMutex_);
+      report_.failed++;
+      std::cerr << "line " << items_[index].line << " ("
+                << items_[index].audioPath << "): " << error << std::endl;
+    }
+    inFlight_--;
+  }
+
+  std::vector<Item> items_;
+  Database &db_;
+  std::string batch_;
+  Options options_;
+
+  std::vector<ItemState> state_;
+  std::vector<size_t> pending_; // indices not already done, in order
+  std::atomic<size_t> cursor_{0};
+  std::atomic<size_t> inFlight_{0};
+
+  int limits_[kStageCount];
+  std::atomic<int> busy_[kStageCount] = {};
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  std::mutex waitMutex_;
+  std::condition_variable wake_;
+  uint64_t epoch_ = 0;
+
+  std::mutex retryMutex_;
+  std::multimap<Clock::time_point, size_t> retries_; // due time -> item
+
+  std::mutex persistMutex_;
+  std::vector<size_t> toPersist_;
+
+  std::mutex reportMutex_;
+  Report report_;
+};
+
+} // namespace batch
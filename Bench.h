@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <string>
+
+// Pieces shared by the benchmark and simulator programs.
+
+namespace bench {
+
+// Collects `--name value` and `--name=value` arguments; anything else is
+// ignored.
+inline std::map<std::string, std::string> parseFlags(int argc, char **argv) {
+  std::map<std::string, std::string> flags;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.rfind("--", 0) != 0) {
+      continue;
+    }
+    size_t eq = arg.find('=');
+    if (eq != std::string::npos) {
+      flags[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    } else if (i + 1 < argc) {
+      flags[arg.substr(2)] = argv[++i];
+    }
+  }
+  return flags;
+}
+
+// Heap allocations made by the current thread, as counted by the hooks below.
+struct AllocationStats {
+  size_t count = 0;
+  size_t bytes = 0;
+};
+inline thread_local AllocationStats threadAllocations;
+
+} // namespace bench
+
+// Counting replacements for the global allocation functions. A program may
+// define them only once, so the benchmark that wants them defines
+// BENCH_COUNT_ALLOCATIONS before including this header in its main file.
+// The deletes are kept out of line: inlined into a caller, GCC sees free()
+// applied to the result of operator new and warns (-Wmismatched-new-delete).
+#ifdef BENCH_COUNT_ALLOCATIONS
+void *operator new(size_t size) {
+  bench::threadAllocations.count++;
+  bench::threadAllocations.bytes += size;
+  if (void *p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+// The pmr default resource allocates through the aligned overloads.
+void *operator new(size_t size, std::align_val_t align) {
+  bench::threadAllocations.count++;
+  bench::threadAllocations.bytes += size;
+  size_t a = static_cast<size_t>(align);
+  if (void *p = std::aligned_alloc(a, (size + a - 1) / a * a)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+  std::free(p);
+}
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept {
+  std::free(p);
+}
+__attribute__((noinline)) void operator delete(void *p,
+                                               std::align_val_t) noexcept {
+  std::free(p);
+}
+__attribute__((noinline)) void operator delete(void *p, size_t,
+                                               std::align_val_t) noexcept {
+  std::free(p);
+}
+#endif
@@ -1,7 +1,17 @@
 #pragma once
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
 #include <sqlite3.h>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Trace.h"
 
 struct User {
   std::string username;
@@ -10,12 +20,48 @@ struct User {
   std::string email;
 };
 
+struct PhonemeScore {
+  std::string phoneme;
+  double accuracy;
+};
+
+struct AssessmentRecord {
+  std::string username;
+  std::string referenceText;
+  double accuracy = 0;
+  double fluency = 0;
+  double completeness = 0;
+  double prosody = 0;
+  double pronunciation = 0;
+  int wordCount = 0;
+  int errorCount = 0;
+  std::vector<PhonemeScore> phonemes;
+  int64_t createdAt = 0; // unix seconds, filled in on insert when zero
+};
+
+struct UserProgress {
+  int64_t count = 0;
+  double accuracy = 0;
+  double fluency = 0;
+  double completeness = 0;
+  double prosody = 0;
+  double pronunciation = 0;
+  // Average pronunciation score over the last Database::kRecentWindow
+  // assessments.
+  double recentPronunciation = 0;
+  int64_t lastAssessedAt = 0;
+  std::vector<PhonemeScore> weakestPhonemes;
+};
+
 class Database {
 public:
   Database(const std::string &path) : db_(nullptr) {
     if (sqlite3_open(path.c_str(), &db_) != SQLITE_OK) {
       throw std::runtime_error(sqlite3_errmsg(db_));
     }
+    // Several worker processes may write at once; wait for the lock instead
+    // of failing with SQLITE_BUSY.
+    sqlite3_busy_timeout(db_, 5000);
     initializeSchema();
   }
 
@@ -25,6 +71,7 @@ public:
   }
 
   bool userExists(const std::string &username) {
+    TRACE_SPAN("db.userExists");
     const char *sql = "SELECT 1 FROM users WHERE username = ?";
     sqlite3_stmt *stmt;
 
@@ -39,6 +86,7 @@ public:
   }
 
   bool emailExists(const std::string &email) {
+    TRACE_SPAN("db.emailExists");
     const char *sql = "SELECT 1 FROM users WHERE email = ?";
     sqlite3_stmt *stmt;
 
@@ -53,6 +101,7 @@ public:
   }
 
   User getUser(const std::string &username) {
+    TRACE_SPAN("db.getUser");
     const char *sql = "SELECT username, password_hash, salt, email FROM users "
                       "WHERE username = ?";
     sqlite3_stmt *stmt;
@@ -81,6 +130,7 @@ public:
   }
 
   void addUser(const User &user) {
+    TRACE_SPAN("db.addUser");
     const char *sql = "INSERT INTO users (username, password_hash, salt, "
                       "email) VALUES (?, ?, ?, ?)";
     sqlite3_stmt *stmt;
@@ -102,11 +152,268 @@ public:
     sqlite3_finalize(stmt);
   }
 
+  static constexpr int kRecentWindow = 10;
+  static constexpr int kWeakestPhonemes = 5;
+  // Phonemes seen fewer times than this are too noisy to call weak.
+  static constexpr int kMinPhonemeSamples = 3;
+
+  // Stores a batch of assessments in one transaction and folds each of them
+  // into the per-user aggregates, so reading progress never has to scan the
+  // history table. `doneKeys` are recorded as finished under `batch` in the
+  // same transaction, so a batch run never sees its results committed but
+  // its items still pending, or the other way round.
+  void addAssessments(const std::vector<AssessmentRecord> &records,
+                      const std::string &batch = "",
+                      const std::vector<std::string> &doneKeys = {}) {
+    TRACE_SPAN("db.addAssessments");
+    if (records.empty() && doneKeys.empty())
+      return;
+
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    exec("BEGIN IMMEDIATE");
+    sqlite3_stmt *insert = nullptr, *loadStats = nullptr, *saveStats = nullptr,
+                 *savePhoneme = nullptr, *markDone = nullptr;
+    try {
+      insert = prepare(
+          "INSERT INTO assessments (username, reference_text, accuracy, "
+          "fluency, completeness, prosody, pronunciation, word_count, "
+          "error_count, created_at) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+      loadStats = prepare(
+          "SELECT count, accuracy_sum, fluency_sum, completeness_sum, "
+          "prosody_sum, pronunciation_sum, recent, recent_head, recent_sum, "
+          "last_at FROM user_stats WHERE username = ?");
+      saveStats = prepare(
+          "INSERT OR REPLACE INTO user_stats (username, count, accuracy_sum, "
+          "fluency_sum, completeness_sum, prosody_sum, pronunciation_sum, "
+          "recent, recent_head, recent_sum, last_at) VALUES "
+          "(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+      savePhoneme = prepare(
+          "INSERT INTO user_phoneme_stats (username, phoneme, count, "
+          "accuracy_sum) VALUES (?, ?, 1, ?) ON CONFLICT(username, phoneme) "
+          "DO UPDATE SET count = count + 1, "
+          "accuracy_sum = accuracy_sum + excluded.accuracy_sum");
+
+      // Aggregates for users touched by this batch are kept in memory and
+      // written back once, however many of their records the batch holds.
+      std::unordered_map<std::string, UserStats> touched;
+      int64_t now = static_cast<int64_t>(std::time(nullptr));
+
+      for (const AssessmentRecord &r : records) {
+        int64_t createdAt = r.createdAt ? r.createdAt : now;
+        sqlite3_bind_text(insert, 1, r.username.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(insert, 2, r.referenceText.c_str(), -1,
+                          SQLITE_STATIC);
+        sqlite3_bind_double(insert, 3, r.accuracy);
+        sqlite3_bind_double(insert, 4, r.fluency);
+        sqlite3_bind_double(insert, 5, r.completeness);
+        sqlite3_bind_double(insert, 6, r.prosody);
+        sqlite3_bind_double(insert, 7, r.pronunciation);
+        sqlite3_bind_int(insert, 8, r.wordCount);
+        sqlite3_bind_int(insert, 9, r.errorCount);
+        sqlite3_bind_int64(insert, 10, createdAt);
+        step(insert);
+
+        auto it = touched.find(r.username);
+        if (it == touched.end()) {
+          it = touched.emplace(r.username, loadUserStats(loadStats, r.username))
+                   .first;
+        }
+        it->second.add(r, createdAt);
+
+        for (const PhonemeScore &p : r.phonemes) {
+          sqlite3_bind_text(savePhoneme, 1, r.username.c_str(), -1,
+                            SQLITE_STATIC);
+          sqlite3_bind_text(savePhoneme, 2, p.phoneme.c_str(), -1,
+                            SQLITE_STATIC);
+          sqlite3_bind_double(savePhoneme, 3, p.accuracy);
+          step(savePhoneme);
+        }
+      }
+
+      for (const auto &[username, stats] : touched) {
+        sqlite3_bind_text(saveStats, 1, username.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(saveStats, 2, stats.count);
+        sqlite3_bind_double(saveStats, 3, stats.accuracySum);
+        sqlite3_bind_double(saveStats, 4, stats.fluencySum);
+        sqlite3_bind_double(saveStats, 5, stats.completenessSum);
+        sqlite3_bind_double(saveStats, 6, stats.prosodySum);
+        sqlite3_bind_double(saveStats, 7, stats.pronunciationSum);
+        sqlite3_bind_blob(saveStats, 8, stats.recent, sizeof(stats.recent),
+                          SQLITE_STATIC);
+        sqlite3_bind_int(saveStats, 9, stats.recentHead);
+        sqlite3_bind_double(saveStats, 10, stats.recentSum);
+        sqlite3_bind_int64(saveStats, 11, stats.lastAt);
+        step(saveStats);
+      }
+
+      if (!doneKeys.empty()) {
+        markDone = prepare(
+            "INSERT OR IGNORE INTO batch_done (batch, key) VALUES (?, ?)");
+        for (const std::string &key : doneKeys) {
+          sqlite3_bind_text(markDone, 1, batch.c_str(), -1, SQLITE_STATIC);
+          sqlite3_bind_text(markDone, 2, key.c_str(), -1, SQLITE_STATIC);
+          step(markDone);
+        }
+      }
+      sqlite3_finalize(insert);
+      sqlite3_finalize(loadStats);
+      sqlite3_finalize(saveStats);
+      sqlite3_finalize(savePhoneme);
+      sqlite3_finalize(markDone);
+      insert = loadStats = saveStats = savePhoneme = markDone = nullptr;
+      exec("COMMIT");
+    } catch (...) {
+      sqlite3_finalize(insert);
+      sqlite3_finalize(loadStats);
+      sqlite3_finalize(saveStats);
+      sqlite3_finalize(savePhoneme);
+      sqlite3_finalize(markDone);
+      sqlite3_exec(db_, "ROLLBACK", nullptr, nullptr, nullptr);
+      throw;
+    }
+  }
+
+  // Keys recorded as finished under `batch` by addAssessments().
+  std::unordered_set<std::string> batchDone(const std::string &batch) {
+    TRACE_SPAN("db.batchDone");
+    std::unordered_set<std::string> keys;
+    sqlite3_stmt *stmt = prepare("SELECT key FROM batch_done WHERE batch = ?");
+    sqlite3_bind_text(stmt, 1, batch.c_str(), -1, SQLITE_STATIC);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      keys.insert(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+    }
+    sqlite3_finalize(stmt);
+    return keys;
+  }
+
+  UserProgress getProgress(const std::string &username) {
+    TRACE_SPAN("db.getProgress");
+    UserProgress progress;
+
+    sqlite3_stmt *stmt = prepare(
+        "SELECT count, accuracy_sum, fluency_sum, completeness_sum, "
+        "prosody_sum, pronunciation_sum, recent, recent_head, recent_sum, "
+        "last_at FROM user_stats WHERE username = ?");
+    UserStats stats = loadUserStats(stmt, username);
+    sqlite3_finalize(stmt);
+
+    if (stats.count == 0) {
+      return progress;
+    }
+    double n = static_cast<double>(stats.count);
+    progress.count = stats.count;
+    progress.accuracy = stats.accuracySum / n;
+    progress.fluency = stats.fluencySum / n;
+    progress.completeness = stats.completenessSum / n;
+    progress.prosody = stats.prosodySum / n;
+    progress.pronunciation = stats.pronunciationSum / n;
+    progress.recentPronunciation =
+        stats.recentSum / std::min<int64_t>(stats.count, kRecentWindow);
+    progress.lastAssessedAt = stats.lastAt;
+
+    // Bounded by the phoneme inventory, not by how many assessments exist.
+    stmt = prepare("SELECT phoneme, accuracy_sum / count AS average FROM "
+                   "user_phoneme_stats WHERE username = ? AND count >= ? "
+                   "ORDER BY average ASC LIMIT ?");
+    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, kMinPhonemeSamples);
+    sqlite3_bind_int(stmt, 3, kWeakestPhonemes);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      progress.weakestPhonemes.push_back(
+          {reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)),
+           sqlite3_column_double(stmt, 1)});
+    }
+    sqlite3_finalize(stmt);
+    return progress;
+  }
+
 private:
   sqlite3 *db_;
+  std::mutex writeMutex_;
+
+  // Running aggregates for one user. `recent` is a ring of the last
+  // kRecentWindow pronunciation scores stored as a blob alongside the sums.
+  struct UserStats {
+    int64_t count = 0;
+    double accuracySum = 0;
+    double fluencySum = 0;
+    double completenessSum = 0;
+    double prosodySum = 0;
+    double pronunciationSum = 0;
+    double recent[kRecentWindow] = {};
+    int recentHead = 0;
+    double recentSum = 0;
+    int64_t lastAt = 0;
+
+    void add(const AssessmentRecord &r, int64_t at) {
+      count++;
+      accuracySum += r.accuracy;
+      fluencySum += r.fluency;
+      completenessSum += r.completeness;
+      prosodySum += r.prosody;
+      pronunciationSum += r.pronunciation;
+      recentSum += r.pronunciation - recent[recentHead];
+      recent[recentHead] = r.pronunciation;
+      recentHead = (recentHead + 1) % kRecentWindow;
+      lastAt = std::max(lastAt, at);
+    }
+  };
+
+  UserStats loadUserStats(sqlite3_stmt *stmt, const std::string &username) {
+    UserStats stats;
+    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+      stats.count = sqlite3_column_int64(stmt, 0);
+      stats.accuracySum = sqlite3_column_double(stmt, 1);
+      stats.fluencySum = sqlite3_column_double(stmt, 2);
+      stats.completenessSum = sqlite3_column_double(stmt, 3);
+      stats.prosodySum = sqlite3_column_double(stmt, 4);
+      stats.pronunciationSum = sqlite3_column_double(stmt, 5);
+      const void *blob = sqlite3_column_blob(stmt, 6);
+      if (blob && sqlite3_column_bytes(stmt, 6) == sizeof(stats.recent)) {
+        std::memcpy(stats.recent, blob, sizeof(stats.recent));
+      }
+      stats.recentHead = sqlite3_column_int(stmt, 7) % kRecentWindow;
+      stats.recentSum = sqlite3_column_double(stmt, 8);
+      stats.lastAt = sqlite3_column_int64(stmt, 9);
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return stats;
+  }
+
+  sqlite3_stmt *prepare(const char *sql) {
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+      throw std::runtime_error(sqlite3_errmsg(db_));
+    }
+    return stmt;
+  }
+
+  // Steps a write statement and resets it for the next row.
+  void step(sqlite3_stmt *stmt) {
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+      std::string error = sqlite3_errmsg(db_);
+      sqlite3_reset(stmt);
+      throw std::runtime_error(error);
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+  }
+
+  void exec(const char *sql) {
+    char *errMsg = nullptr;
+    if (sqlite3_exec(db_, sql, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+      std::string error = errMsg;
+      sqlite3_free(errMsg);
+      throw std::runtime_error(error);
+    }
+  }
 
   void initializeSchema() {
     const char *sql = R"(
+            PRAGMA journal_mode = WAL;
+
             CREATE TABLE IF NOT EXISTS users (
                 id INTEGER PRIMARY KEY AUTOINCREMENT,
                 username TEXT UNIQUE NOT NULL,
@@ -114,6 +421,51 @@ private:
                 salt TEXT NOT NULL,
                 email TEXT UNIQUE NOT NULL
             );
+
+            CREATE TABLE IF NOT EXISTS assessments (
+                id INTEGER PRIMARY KEY AUTOINCREMENT,
+                username TEXT NOT NULL,
+                reference_text TEXT NOT NULL,
+                accuracy REAL NOT NULL,
+                fluency REAL NOT NULL,
+                completeness REAL NOT NULL,
+                prosody REAL NOT NULL,
+                pronunciation REAL NOT NULL,
+                word_count INTEGER NOT NULL,
+                error_count INTEGER NOT NULL,
+                created_at INTEGER NOT NULL
+            );
+
+            CREATE INDEX IF NOT EXISTS assessments_by_user
+                ON assessments (username, created_at);
+
+            CREATE TABLE IF NOT EXISTS user_stats (
+                username TEXT PRIMARY KEY,
+                count INTEGER NOT NULL,
+                accuracy_sum REAL NOT NULL,
+                fluency_sum REAL NOT NULL,
+                completeness_sum REAL NOT NULL,
+                prosody_sum REAL NOT NULL,
+                pronunciation_sum REAL NOT NULL,
+                recent BLOB NOT NULL,
+                recent_head INTEGER NOT NULL,
+                recent_sum REAL NOT NULL,
+                last_at INTEGER NOT NULL
+            ) WITHOUT ROWID;
+
+            CREATE TABLE IF NOT EXISTS user_phoneme_stats (
+                username TEXT NOT NULL,
+                phoneme TEXT NOT NULL,
+                count INTEGER NOT NULL,
+                accuracy_sum REAL NOT NULL,
+                PRIMARY KEY (username, phoneme)
+            ) WITHOUT ROWID;
+
+            CREATE TABLE IF NOT EXISTS batch_done (
+                batch TEXT NOT NULL,
+                key TEXT NOT NULL,
+                PRIMARY KEY (batch, key)
+            ) WITHOUT ROWID;
         )";
 
     char *errMsg = nullptr;
@@ -7,6 +7,8 @@
 #include <regex>
 #include <string>
 
+#include "Trace.h"
+
 namespace auth_utils {
 std::string generate_salt(size_t length = 16) {
   unsigned char buffer[length];
@@ -24,6 +26,7 @@ std::string generate_salt(size_t length = 16) {
 // Hash password with salt using modern EVP API (OpenSSL 3.0 compatible)
 std::string hash_password(const std::string &password,
                           const std::string &salt) {
+  TRACE_SPAN("hash_password");
   std::string salted = password + salt;
 
   unsigned char hash[EVP_MAX_MD_SIZE];
@@ -45,11 +48,13 @@ std::string hash_password(const std::string &password,
 }
 
 bool is_valid_email(const std::string &email) {
+  TRACE_SPAN("validate.email");
   const std::regex pattern(R"([a-zA-Z0-9._%+-]+@[a-zA-Z0-9.-]+\.[a-zA-Z]{2,})");
   return std::regex_match(email, pattern);
 }
 
 bool is_valid_username(const std::string &username) {
+  TRACE_SPAN("validate.username");
   // Username should be alphanumeric and at least 3 characters
   const std::regex pattern(R"([a-zA-Z0-9_]{3,})");
   return std::regex_match(username, pattern);
@@ -129,12 +134,16 @@ public:
 User validate_jwt(const std::string &token, Database &db) {
   std::string secret_key = Config::getInstance().getJwtSecretKey();
 
-  auto decoded = jwt::decode(token);
-  auto verifier = jwt::verify()
-                      .allow_algorithm(jwt::algorithm::hs256{secret_key})
-                      .with_issuer("auth_service");
+  auto decoded = [&] {
+    TRACE_SPAN("jwt.verify");
+    auto decoded = jwt::decode(token);
+    auto verifier = jwt::verify()
+                        .allow_algorithm(jwt::algorithm::hs256{secret_key})
+                        .with_issuer("auth_service");
 
-  verifier.verify(decoded);
+    verifier.verify(decoded);
+    return decoded;
+  }();
 
   if (!decoded.has_payload_claim("username")) {
     throw std::runtime_error("Token missing username claim");
@@ -0,0 +1,261 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <curl/curl.h>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Upstream.h"
+
+// WAV header for 16kHz, 16-bit mono PCM
+const std::vector<uint8_t> waveHeader16K16BitMono = {
+    82, 73, 70, 70, 78, 128, 0,   0,  87,  65, 86, 69, 102, 109, 116, 32,
+    18, 0,  0,  0,  1,  0,   1,   0,  128, 62, 0,  0,  0,   125, 0,   0,
+    2,  0,  16, 0,  0,  0,   100, 97, 116, 97, 0,  0,  0,   0};
+
+struct PronunciationAssessmentParams {
+  std::string GradingSystem = "HundredMark";
+  std::string Dimension = "Comprehensive";
+  std::string ReferenceText;
+  std::string EnableProsodyAssessment = "true";
+  std::string PhonemeAlphabet = "SAPI";
+  std::string EnableMiscue = "true";
+  std::string NBestPhonemeCount = "5";
+
+  std::string toBase64Json() const {
+    nlohmann::json j = {{"GradingSystem", GradingSystem},
+                        {"Dimension", Dimension},
+                        {"ReferenceText", ReferenceText},
+                        {"EnableProsodyAssessment", EnableProsodyAssessment},
+                        {"PhonemeAlphabet", PhonemeAlphabet},
+                        {"EnableMiscue", EnableMiscue},
+                        {"NBestPhonemeCount", NBestPhonemeCount}};
+
+    std::string jsonStr = j.dump();
+    std::string encoded;
+    CURL *curl = curl_easy_init();
+    if (curl) {
+      char *output = curl_easy_escape(curl, jsonStr.c_str(), jsonStr.length());
+      if (output) {
+        encoded = output;
+        curl_free(output);
+      }
+      curl_easy_cleanup(curl);
+    }
+    return encoded;
+  }
+};
+
+namespace speech {
+
+// 16kHz 16-bit mono
+constexpr size_t kBytesPerSecond = 32000;
+
+inline std::string generateSessionID() {
+  std::ostringstream oss;
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_int_distribution<uint64_t> dis;
+  oss << std::hex << dis(gen);
+  return oss.str();
+}
+
+// Lets the endpoints be pointed at a local stand-in server.
+inline std::string endpoint(const char *envName, const std::string &fallback) {
+  const char *env = std::getenv(envName);
+  return env ? std::string(env) : fallback;
+}
+
+inline std::string sttUrl(const std::string &region, const std::string &locale,
+                          const std::string &sessionID) {
+  return endpoint("STT_ENDPOINT",
+                  "https://" + region + ".stt.speech.microsoft.com") +
+         "/speech/recognition/conversation/cognitiveservices/v1"
+         "?format=detailed&language=" +
+         locale + "&X-ConnectionId=" + sessionID;
+}
+
+// Streams a WAV buffer to the service in chunkSize pieces. With `realtime`
+// set the upload is paced like a live microphone.
+struct AudioUpload {
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  size_t chunkSize = 1024;
+  bool realtime = false;
+  size_t sent = 0;
+  // When curl first asked for body data; with "Expect: 100-continue" that is
+  // after the interim response, not when the headers went out.
+  std::chrono::steady_clock::time_point firstByte{};
+
+  static size_t readCallback(char *ptr, size_t size, size_t nmemb,
+                             void *userp) {
+    AudioUpload *upload = static_cast<AudioUpload *>(userp);
+    if (upload->firstByte.time_since_epoch().count() == 0) {
+      upload->firstByte = std::chrono::steady_clock::now();
+    }
+    size_t n = std::min({size * nmemb, upload->chunkSize,
+                         upload->size - upload->sent});
+    std::memcpy(ptr, upload->data + upload->sent, n);
+    upload->sent += n;
+    if (upload->realtime && n) {
+      std::this_thread::sleep_for(
+          std::chrono::microseconds(n * 1000000 / kBytesPerSecond));
+    }
+    return n;
+  }
+};
+
+inline size_t appendToString(void *contents, size_t size, size_t nmemb,
+                             void *userp) {
+  size_t totalSize = size * nmemb;
+  static_cast<std::string *>(userp)->append(static_cast<char *>(contents),
+                                            totalSize);
+  return totalSize;
+}
+
+// Collects a response body and notes when its first byte arrived. curl's own
+// start-transfer time is not usable here because it fires on the interim
+// "100 Continue" of an upload.
+struct ResponseSink {
+  std::string body;
+  std::chrono::steady_clock::time_point firstByte{};
+
+  static size_t write(void *contents, size_t size, size_t nmemb,
+                      void *userp) {
+    ResponseSink *sink = static_cast<ResponseSink *>(userp);
+    if (sink->body.empty()) {
+      sink->firstByte = std::chrono::steady_clock::now();
+    }
+    return appendToString(contents, size, nmemb, &sink->body);
+  }
+};
+
+struct Response {
+  UpstreamResult call;
+  std::string body;
+  // From the start of the call to the first byte of the response body.
+  double firstByteMs = 0;
+};
+
+// Sends one recording for pronunciation assessment. The upload is not
+// hedged: it is paced from a single cursor and already costs the learner
+// the length of the recording.
+inline Response assess(const std::string &url,
+                       const std::string &subscriptionKey,
+                       const PronunciationAssessmentParams &params,
+                       AudioUpload audio, const UpstreamPolicy &policy) {
+  TRACE_REQUEST("stt.assess");
+  struct curl_slist *headers = nullptr;
+  headers = curl_slist_append(headers, "Accept: application/json;text/xml");
+  headers = curl_slist_append(headers, "Connection: Keep-Alive");
+  headers = curl_slist_append(
+      headers, "Content-Type: audio/wav; codecs=audio/pcm; samplerate=16000");
+  headers = curl_slist_append(
+      headers, ("Ocp-Apim-Subscription-Key: " + subscriptionKey).c_str());
+  headers = curl_slist_append(
+      headers, ("Pronunciation-Assessment: " + params.toBase64Json()).c_str());
+  headers = curl_slist_append(headers, "Transfer-Encoding: chunked");
+  headers = curl_slist_append(headers, "Expect: 100-continue");
+
+  // A paced upload cannot finish before the recording has been played out,
+  // so the deadline only starts counting after that.
+  UpstreamPolicy bounded = policy;
+  if (audio.realtime) {
+    bounded.deadlineMs += static_cast<long>(audio.size * 1000 / kBytesPerSecond);
+  }
+
+  ResponseSink sink;
+  Response response;
+  auto start = std::chrono::steady_clock::now();
+  uint64_t startNs = trace::nowNs();
+  response.call = upstream::perform(
+      Upstream::forUrl(url), bounded,
+      [&](int) {
+        CURL *curl = curl_easy_init();
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_READFUNCTION, AudioUpload::readCallback);
+        curl_easy_setopt(curl, CURLOPT_READDATA, &audio);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ResponseSink::write);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+        return curl;
+      },
+      false);
+
+  if (audio.firstByte.time_since_epoch().count() != 0) {
+    trace::record("upstream.first_upload_byte", startNs,
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      audio.firstByte - start)
+                      .count());
+  }
+  if (!sink.body.empty()) {
+    response.firstByteMs = std::chrono::duration<double, std::milli>(
+                               sink.firstByte - start)
+                               .count();
+    trace::record("upstream.first_response_byte", startNs,
+                  static_cast<uint64_t>(response.firstByteMs * 1e6));
+  }
+  response.body = std::move(sink.body);
+
+  curl_slist_free_all(headers);
+  return response;
+}
+
+// Synthesizes SSML to audio. Synthesis is idempotent, so slow attempts are
+// hedged according to `policy`.
+inline Response synthesize(const std::string &url,
+                           const std::string &subscriptionKey,
+                           const std::string &ssml,
+                           const UpstreamPolicy &policy) {
+  TRACE_REQUEST("tts.synthesize");
+  struct curl_slist *headers = nullptr;
+  headers = curl_slist_append(
+      headers, ("Ocp-Apim-Subscription-Key: " + subscriptionKey).c_str());
+  headers = curl_slist_append(headers, "Content-Type: application/ssml+xml");
+  headers = curl_slist_append(
+      headers, "X-Microsoft-OutputFormat: audio-16khz-128kbitrate-mono-mp3");
+  headers = curl_slist_append(headers, "User-Agent: curl");
+
+  ResponseSink sinks[2];
+  Response response;
+  auto start = std::chrono::steady_clock::now();
+  uint64_t startNs = trace::nowNs();
+  response.call = upstream::perform(
+      Upstream::forUrl(url), policy,
+      [&](int attempt) {
+        CURL *curl = curl_easy_init();
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, ssml.c_str());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, ssml.size());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ResponseSink::write);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sinks[attempt]);
+        return curl;
+      },
+      true);
+
+  if (response.call.winner >= 0) {
+    ResponseSink &sink = sinks[response.call.winner];
+    if (!sink.body.empty()) {
+      response.firstByteMs = std::chrono::duration<double, std::milli>(
+                                 sink.firstByte - start)
+                                 .count();
+      trace::record("upstream.first_response_byte", startNs,
+                    static_cast<uint64_t>(response.firstByteMs * 1e6));
+    }
+    response.body = std::move(sink.body);
+  }
+  curl_slist_free_all(headers);
+  return response;
+}
+
+} // namespace speech
@@ -0,0 +1,282 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Lightweight span tracing. A request opens a root span with TRACE_REQUEST;
+// whether it is recorded is decided once, there, by the sample rate. Nested
+// TRACE_SPANs on the same thread are recorded only for sampled requests, so
+// with sampling off a span costs a thread-local flag check. Spans go into a
+// per-thread ring that only its own thread writes, and dump() renders every
+// ring as Chrome/Perfetto trace JSON. Build with -DPTE_TRACE_DISABLED to
+// compile the macros out entirely.
+
+namespace trace {
+
+inline uint64_t nowNs() {
+  static const auto epoch = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - epoch)
+      .count();
+}
+
+// Ring of the most recent events of one thread. The owning thread is the only
+// writer; readers use each slot's sequence number to skip slots that are
+// being overwritten while they read.
+class ThreadBuffer {
+public:
+  static constexpr size_t kCapacity = 8192;
+
+  explicit ThreadBuffer(uint32_t tid) : tid(tid) {}
+
+  const uint32_t tid;
+
+  void push(const char *name, uint64_t startNs, uint64_t durNs,
+            uint64_t traceId) {
+    uint64_t index = head_.load(std::memory_order_relaxed);
+    Slot &slot = slots_[index % kCapacity];
+    uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.startNs.store(startNs, std::memory_order_relaxed);
+    slot.durNs.store(durNs, std::memory_order_relaxed);
+    slot.traceId.store(traceId, std::memory_order_relaxed);
+    slot.seq.store(seq + 2, std::memory_order_release);
+    head_.store(index + 1, std::memory_order_release);
+  }
+
+  struct Event {
+    const char *name;
+    uint64_t startNs;
+    uint64_t durNs;
+    uint64_t traceId;
+  };
+
+  void collect(std::vector<Event> &out) const {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t begin = head > kCapacity ? head - kCapacity : 0;
+    for (uint64_t i = begin; i < head; i++) {
+      const Slot &slot = slots_[i % kCapacity];
+      uint64_t before = slot.seq.load(std::memory_order_acquire);
+      Event e{slot.name.load(std::memory_order_relaxed),
+              slot.startNs.load(std::memory_order_relaxed),
+              slot.durNs.load(std::memory_order_relaxed),
+              slot.traceId.load(std::memory_order_relaxed)};
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (before % 2 == 0 && slot.seq.load(std::memory_order_relaxed) == before &&
+          e.name) {
+        out.push_back(e);
+      }
+    }
+  }
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    std::atomic<const char *> name{nullptr};
+    std::atomic<uint64_t> startNs{0};
+    std::atomic<uint64_t> durNs{0};
+    std::atomic<uint64_t> traceId{0};
+  };
+
+  std::atomic<uint64_t> head_{0};
+  Slot slots_[kCapacity];
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  // Sampling threshold out of 2^32; 0 disables tracing.
+  std::atomic<uint64_t> threshold{0};
+  std::atomic<uint64_t> nextTraceId{1};
+
+  static Registry &instance() {
+    static Registry registry;
+    return registry;
+  }
+};
+
+struct ThreadState {
+  std::shared_ptr<ThreadBuffer> buffer;
+  uint64_t traceId = 0; // non-zero while a sampled request is open
+  uint64_t rng = 0;
+
+  ThreadBuffer &get() {
+    if (!buffer) {
+      Registry &r = Registry::instance();
+      std::lock_guard<std::mutex> lock(r.mutex);
+      buffer = std::make_shared<ThreadBuffer>(
+          static_cast<uint32_t>(r.buffers.size() + 1));
+      r.buffers.push_back(buffer);
+    }
+    return *buffer;
+  }
+};
+
+inline ThreadState &threadState() {
+  static thread_local ThreadState state;
+  return state;
+}
+
+// Fraction of requests to record, 0 to 1. Safe to change at any time.
+inline void setSampleRate(double rate) {
+  rate = rate < 0 ? 0 : rate > 1 ? 1 : rate;
+  Registry::instance().threshold.store(
+      static_cast<uint64_t>(rate * 4294967296.0), std::memory_order_relaxed);
+}
+
+inline double sampleRate() {
+  return Registry::instance().threshold.load(std::memory_order_relaxed) /
+         4294967296.0;
+}
+
+inline void initFromEnv() {
+  if (const char *rate = std::getenv("TRACE_SAMPLE_RATE")) {
+    setSampleRate(std::atof(rate));
+  }
+}
+
+inline bool active() { return threadState().traceId != 0; }
+
+// Records a span whose timing was measured elsewhere, e.g. phases that curl
+// reports after the fact. Dropped unless the current request is sampled.
+inline void record(const char *name, uint64_t startNs, uint64_t durNs) {
+  ThreadState &state = threadState();
+  if (state.traceId) {
+    state.get().push(name, startNs, durNs, state.traceId);
+  }
+}
+
+class Span {
+public:
+  explicit Span(const char *name) : name_(name), on_(active()) {
+    if (on_) {
+      startNs_ = nowNs();
+    }
+  }
+  ~Span() {
+    if (on_) {
+      record(name_, startNs_, nowNs() - startNs_);
+    }
+  }
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+private:
+  const char *name_;
+  bool on_;
+  uint64_t startNs_ = 0;
+};
+
+// Opens a request and decides whether it is sampled. Nested roots (e.g. a
+// speech call made while handling a request) join the enclosing trace.
+class Root {
+public:
+  explicit Root(const char *name) : name_(name) {
+    ThreadState &state = threadState();
+    if (state.traceId) {
+      on_ = true;
+      startNs_ = nowNs();
+      return;
+    }
+    uint64_t threshold =
+        Registry::instance().threshold.load(std::memory_order_relaxed);
+    if (threshold == 0) {
+      return;
+    }
+    // xorshift; only the decision needs to be cheap, not strong.
+    uint64_t &x = state.rng;
+    if (x == 0) {
+      x = reinterpret_cast<uintptr_t>(&state) ^ nowNs() ^ 0x9e3779b97f4a7c15;
+    }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    if ((x & 0xffffffff) < threshold) {
+      on_ = owner_ = true;
+      state.traceId = Registry::instance().nextTraceId.fetch_add(1);
+      startNs_ = nowNs();
+    }
+  }
+
+  ~Root() {
+    if (on_) {
+      record(name_, startNs_, nowNs() - startNs_);
+    }
+    if (owner_) {
+      threadState().traceId = 0;
+    }
+  }
+
+  Root(const Root &) = delete;
+  Root &operator=(const Root &) = delete;
+
+private:
+  const char *name_;
+  uint64_t startNs_ = 0;
+  bool on_ = false;
+  bool owner_ = false;
+};
+
+// Renders every thread's ring as Chrome trace JSON ("X" complete events).
+// Span names are string literals, so they need no escaping.
+inline std::string dump() {
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  {
+    Registry &r = Registry::instance();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    buffers = r.buffers;
+  }
+
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  std::vector<ThreadBuffer::Event> events;
+  char line[256];
+  bool first = true;
+  int pid = static_cast<int>(getpid());
+  for (const auto &buffer : buffers) {
+    events.clear();
+    buffer->collect(events);
+    for (const ThreadBuffer::Event &e : events) {
+      snprintf(line, sizeof(line),
+               "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+               "\"pid\":%d,\"tid\":%u,\"args\":{\"trace\":%llu}}",
+               first ? "" : ",", e.name, e.startNs / 1000.0, e.durNs / 1000.0,
+               pid, buffer->tid, static_cast<unsigned long long>(e.traceId));
+      out += line;
+      first = false;
+    }
+  }
+  out += "]}";
+  return out;
+}
+
+// Writes dump() to the file named by TRACE_FILE, if set.
+inline void dumpToEnvFile() {
+  if (const char *path = std::getenv("TRACE_FILE")) {
+    if (FILE *f = std::fopen(path, "w")) {
+      std::string json = dump();
+      std::fwrite(json.data(), 1, json.size(), f);
+      std::fclose(f);
+    }
+  }
+}
+
+} // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#ifdef PTE_TRACE_DISABLED
+#define TRACE_REQUEST(name)
+#define TRACE_SPAN(name)
+#else
+#define TRACE_REQUEST(name) trace::Root TRACE_CONCAT(traceRoot, __LINE__)(name)
+#define TRACE_SPAN(name) trace::Span TRACE_CONCAT(traceSpan, __LINE__)(name)
+#endif
@@ -0,0 +1,357 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <curl/curl.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Trace.h"
+
+// How calls to a speech endpoint are bounded. Every knob can be overridden
+// from the environment so the policy can be tuned without a rebuild.
+struct UpstreamPolicy {
+  long connectTimeoutMs = 3000;
+  // Budget for the whole logical call, hedge included.
+  long deadlineMs = 15000;
+  // Only honoured for idempotent calls.
+  bool hedge = true;
+  double hedgePercentile = 0.95;
+  // Used until enough latencies have been seen to estimate the percentile.
+  long defaultHedgeDelayMs = 1000;
+  long minHedgeDelayMs = 20;
+  int breakerFailureThreshold = 5;
+  long breakerOpenMs = 10000;
+
+  static UpstreamPolicy fromEnv() {
+    UpstreamPolicy policy;
+    readEnv("UPSTREAM_CONNECT_TIMEOUT_MS", policy.connectTimeoutMs);
+    readEnv("UPSTREAM_DEADLINE_MS", policy.deadlineMs);
+    readEnv("UPSTREAM_HEDGE_DELAY_MS", policy.defaultHedgeDelayMs);
+    readEnv("UPSTREAM_BREAKER_OPEN_MS", policy.breakerOpenMs);
+    long threshold = policy.breakerFailureThreshold;
+    readEnv("UPSTREAM_BREAKER_FAILURES", threshold);
+    policy.breakerFailureThreshold = static_cast<int>(threshold);
+    if (const char *hedge = std::getenv("UPSTREAM_HEDGE")) {
+      policy.hedge = std::string(hedge) != "0";
+    }
+    return policy;
+  }
+
+private:
+  static void readEnv(const char *name, long &value) {
+    if (const char *env = std::getenv(name)) {
+      value = std::strtol(env, nullptr, 10);
+    }
+  }
+};
+
+// Recent successful call latencies, used to pick the hedge delay.
+class LatencyTracker {
+public:
+  static constexpr size_t kCapacity = 256;
+  static constexpr size_t kMinSamples = 20;
+
+  void record(double ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    samples_[next_++ % kCapacity] = ms;
+  }
+
+  // Returns a negative value until kMinSamples latencies have been seen.
+  double percentile(double p) const {
+    std::vector<double> sorted;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      size_t n = std::min(next_, kCapacity);
+      if (n < kMinSamples) {
+        return -1;
+      }
+      sorted.assign(samples_, samples_ + n);
+    }
+    size_t rank = static_cast<size_t>(p * (sorted.size() - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+  }
+
+private:
+  mutable std::mutex mutex_;
+  double samples_[kCapacity] = {};
+  size_t next_ = 0;
+};
+
+// Classic three-state breaker: after enough consecutive failures the
+// endpoint is skipped outright for breakerOpenMs, then a single probe call is
+// let through to decide whether to close again.
+class CircuitBreaker {
+public:
+  enum class State { Closed, Open, HalfOpen };
+
+  bool allow(const UpstreamPolicy &policy) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ == State::Open) {
+      if (Clock::now() - openedAt_ <
+          std::chrono::milliseconds(policy.breakerOpenMs)) {
+        return false;
+      }
+      state_ = State::HalfOpen;
+      probeInFlight_ = false;
+    }
+    if (state_ == State::HalfOpen) {
+      if (probeInFlight_) {
+        return false;
+      }
+      probeInFlight_ = true;
+    }
+    return true;
+  }
+
+  void onSuccess() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    state_ = State::Closed;
+    failures_ = 0;
+  }
+
+  void onFailure(const UpstreamPolicy &policy) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ == State::HalfOpen ||
+        ++failures_ >= policy.breakerFailureThreshold) {
+      state_ = State::Open;
+      openedAt_ = Clock::now();
+      failures_ = 0;
+    }
+  }
+
+  State state() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return state_;
+  }
+
+  // Time left before an open breaker lets a probe through; zero otherwise.
+  std::chrono::milliseconds retryAfter(const UpstreamPolicy &policy) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ != State::Open) {
+      return std::chrono::milliseconds(0);
+    }
+    auto left = std::chrono::milliseconds(policy.breakerOpenMs) -
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    Clock::now() - openedAt_);
+    return std::max(left, std::chrono::milliseconds(0));
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  mutable std::mutex mutex_;
+  State state_ = State::Closed;
+  int failures_ = 0;
+  bool probeInFlight_ = false;
+  Clock::time_point openedAt_;
+};
+
+// Health and latency state shared by every call to one region endpoint.
+class Upstream {
+public:
+  CircuitBreaker breaker;
+  LatencyTracker latency;
+
+  // Keyed by scheme and host, e.g. "https://eastus.stt.speech.microsoft.com".
+  static Upstream &forUrl(const std::string &url) {
+    static std::mutex mutex;
+    static std::map<std::string, std::unique_ptr<Upstream>> registry;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &slot = registry[endpointKey(url)];
+    if (!slot) {
+      slot = std::make_unique<Upstream>();
+    }
+    return *slot;
+  }
+
+  static std::string endpointKey(const std::string &url) {
+    size_t scheme = url.find("://");
+    size_t start = scheme == std::string::npos ? 0 : scheme + 3;
+    return url.substr(0, url.find('/', start));
+  }
+};
+
+struct UpstreamResult {
+  CURLcode code = CURLE_OK;
+  long httpCode = 0;
+  // Set when the breaker refused the call without touching the network.
+  bool rejected = false;
+  bool deadlineExceeded = false;
+  bool hedged = false;
+  // Index of the attempt whose response was used (0 primary, 1 hedge).
+  int winner = -1;
+  double totalMs = 0;
+
+  bool ok() const { return winner >= 0 && httpCode >= 200 && httpCode < 300; }
+};
+
+namespace upstream {
+
+// Builds the easy handle for one attempt. `attempt` is 0 for the primary and
+// 1 for the hedge so each attempt can write into its own buffer. The handle
+// is cleaned up by perform().
+using AttemptFactory = std::function<CURL *(int attempt)>;
+
+// One multi handle per thread, kept alive so its connection cache lets
+// consecutive calls to the same endpoint skip the TCP and TLS handshakes.
+inline CURLM *threadMulti() {
+  struct Holder {
+    CURLM *multi = curl_multi_init();
+    ~Holder() { curl_multi_cleanup(multi); }
+  };
+  static thread_local Holder holder;
+  return holder.multi;
+}
+
+// Records the connection phases curl timed for a finished attempt, relative
+// to when it was launched. Phases skipped on a reused connection are 0 and
+// left out. The first body byte is traced by the caller, since only its read
+// callback knows when that was sent.
+inline void tracePhases(CURL *easy, uint64_t launchedNs) {
+  curl_off_t dns = 0, connect = 0, tls = 0;
+  curl_easy_getinfo(easy, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+  curl_easy_getinfo(easy, CURLINFO_CONNECT_TIME_T, &connect);
+  curl_easy_getinfo(easy, CURLINFO_APPCONNECT_TIME_T, &tls);
+
+  auto phase = [&](const char *name, curl_off_t fromUs, curl_off_t toUs) {
+    if (toUs > fromUs) {
+      trace::record(name, launchedNs + fromUs * 1000, (toUs - fromUs) * 1000);
+    }
+  };
+  phase("upstream.dns", 0, dns);
+  phase("upstream.connect", dns, connect);
+  phase("upstream.tls", connect, tls);
+}
+
+inline bool retryable(CURLcode code, long httpCode) {
+  return code != CURLE_OK || httpCode >= 500 || httpCode == 429;
+}
+
+// Runs one logical call against `up` under `policy`: the breaker is
+// consulted first, the call is bounded by the deadline, and for idempotent
+// calls a duplicate attempt is fired once the primary has been outstanding
+// longer than the recent p95 (or immediately if the primary fails). The first
+// good response wins and the other attempt is abandoned.
+inline UpstreamResult perform(Upstream &up, const UpstreamPolicy &policy,
+                              const AttemptFactory &makeAttempt,
+                              bool idempotent) {
+  using Clock = std::chrono::steady_clock;
+  UpstreamResult result;
+
+  if (!up.breaker.allow(policy)) {
+    result.rejected = true;
+    result.code = CURLE_COULDNT_CONNECT;
+    return result;
+  }
+
+  bool mayHedge = idempotent && policy.hedge;
+  double hedgeDelayMs = policy.defaultHedgeDelayMs;
+  if (double p = up.latency.percentile(policy.hedgePercentile); p >= 0) {
+    hedgeDelayMs = std::max<double>(p, policy.minHedgeDelayMs);
+  }
+
+  auto start = Clock::now();
+  auto deadline = start + std::chrono::milliseconds(policy.deadlineMs);
+  auto hedgeAt =
+      start + std::chrono::microseconds(static_cast<long>(hedgeDelayMs * 1000));
+
+  CURLM *multi = threadMulti();
+  CURL *attempts[2] = {nullptr, nullptr};
+  uint64_t launchedNs[2] = {0, 0};
+  int launched = 0;
+  int finished = 0;
+
+  auto launch = [&]() {
+    CURL *easy = makeAttempt(launched);
+    long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         deadline - Clock::now())
+                         .count();
+    curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS,
+                     std::min(policy.connectTimeoutMs, remaining));
+    curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, std::max(remaining, 1L));
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, reinterpret_cast<char *>(
+                                                static_cast<intptr_t>(launched)));
+    curl_multi_add_handle(multi, easy);
+    launchedNs[launched] = trace::nowNs();
+    attempts[launched++] = easy;
+  };
+
+  launch();
+  int running = 1;
+  while (result.winner < 0) {
+    curl_multi_perform(multi, &running);
+
+    int queued;
+    while (CURLMsg *msg = curl_multi_info_read(multi, &queued)) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+      finished++;
+      char *priv;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &priv);
+      int index = static_cast<int>(reinterpret_cast<intptr_t>(priv));
+      long httpCode = 0;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &httpCode);
+
+      bool last = finished == launched && (launched == 2 || !mayHedge);
+      if (!retryable(msg->data.result, httpCode) || last) {
+        result.winner = index;
+        result.code = msg->data.result;
+        result.httpCode = httpCode;
+        break;
+      }
+    }
+    if (result.winner >= 0) {
+      break;
+    }
+
+    auto now = Clock::now();
+    if (now >= deadline) {
+      result.deadlineExceeded = true;
+      result.code = CURLE_OPERATION_TIMEDOUT;
+      break;
+    }
+    // A failed primary is retried straight away instead of at hedgeAt.
+    if (mayHedge && launched == 1 && (now >= hedgeAt || finished == 1)) {
+      launch();
+      result.hedged = true;
+      continue;
+    }
+
+    auto wakeAt = (mayHedge && launched == 1) ? std::min(hedgeAt, deadline)
+                                              : deadline;
+    int waitMs = static_cast<int>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(wakeAt - now)
+            .count());
+    curl_multi_poll(multi, nullptr, 0, std::clamp(waitMs, 1, 1000), nullptr);
+  }
+
+  if (result.winner >= 0 && trace::active()) {
+    tracePhases(attempts[result.winner], launchedNs[result.winner]);
+  }
+  for (int i = 0; i < launched; i++) {
+    curl_multi_remove_handle(multi, attempts[i]);
+    curl_easy_cleanup(attempts[i]);
+  }
+
+  result.totalMs =
+      std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  if (retryable(result.code, result.httpCode)) {
+    up.breaker.onFailure(policy);
+  } else {
+    up.breaker.onSuccess();
+    up.latency.record(result.totalMs);
+  }
+  return result;
+}
+
+} // namespace upstream
@@ -0,0 +1,377 @@
+#pragma once
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// What the stand-in server does to each request.
+struct SimBehaviour {
+  // Processing delay after the request body has been read.
+  double latencyMs = 20;
+  double jitterMs = 5;
+  // Fraction of requests that are delayed by stragglerMs on top.
+  double stragglerRate = 0;
+  double stragglerMs = 1000;
+  // Fraction of requests answered with 503.
+  double failureRate = 0;
+  // Size of the synthesized audio returned by the TTS route.
+  size_t audioBytes = 16 * 1024;
+  // Extra processing per second of uploaded audio on the STT route, to model
+  // a recognizer that runs slower or faster than real time.
+  double latencyPerAudioSecondMs = 0;
+  // Detailed assessment JSON returned by the STT route.
+  std::shared_ptr<const std::string> assessmentBody;
+  // When non-zero, responses are sent chunked in pieces of this size with
+  // chunkDelayMs between them, like a service that streams its answer.
+  size_t responseChunkBytes = 0;
+  double chunkDelayMs = 0;
+};
+
+// Local HTTP/1.1 server that stands in for the Azure speech endpoints so the
+// upstream policy can be exercised without network access or credentials.
+// One detached thread per connection; keep-alive, chunked uploads and
+// "Expect: 100-continue" are supported because curl uses all three.
+class UpstreamSim {
+public:
+  explicit UpstreamSim(SimBehaviour behaviour = {}) : behaviour_(behaviour) {}
+  ~UpstreamSim() { stop(); }
+
+  UpstreamSim(const UpstreamSim &) = delete;
+  UpstreamSim &operator=(const UpstreamSim &) = delete;
+
+  // Binds 127.0.0.1:port (0 picks a free port) and returns the bound port.
+  uint16_t start(uint16_t port = 0) {
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ < 0) {
+      throw std::runtime_error("socket: " + std::string(strerror(errno)));
+    }
+    int one = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(listenFd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+            0 ||
+        listen(listenFd_, 512) < 0) {
+      std::string error = strerror(errno);
+      close(listenFd_);
+      throw std::runtime_error("bind: " + error);
+    }
+    socklen_t len = sizeof(addr);
+    getsockname(listenFd_, reinterpret_cast<sockaddr *>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+
+    running_ = true;
+    acceptor_ = std::thread([this] { acceptLoop(); });
+    return port_;
+  }
+
+  void stop() {
+    if (!running_.exchange(false)) {
+      return;
+    }
+    shutdown(listenFd_, SHUT_RDWR);
+    close(listenFd_);
+    acceptor_.join();
+
+    // Connection threads are detached so finished ones release their stacks
+    // at once; wait until the last one has let go of this object.
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (int fd : clients_) {
+      shutdown(fd, SHUT_RDWR);
+    }
+    drained_.wait(lock, [this] { return clients_.empty(); });
+  }
+
+  std::string baseUrl() const {
+    return "http://127.0.0.1:" + std::to_string(port_);
+  }
+
+  void setBehaviour(const SimBehaviour &behaviour) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    behaviour_ = behaviour;
+  }
+
+  size_t requests() const { return requests_.load(); }
+
+private:
+  struct Request {
+    std::string method;
+    std::string path;
+    std::string body;
+    bool keepAlive = true;
+  };
+
+  // Buffered reader over one client socket.
+  class Connection {
+  public:
+    explicit Connection(int fd) : fd_(fd) {}
+
+    bool readRequest(Request &req) {
+      std::string head;
+      if (!readUntil("\r\n\r\n", head)) {
+        return false;
+      }
+      size_t lineEnd = head.find("\r\n");
+      std::string requestLine = head.substr(0, lineEnd);
+      size_t sp1 = requestLine.find(' ');
+      size_t sp2 = requestLine.find(' ', sp1 + 1);
+      req.method = requestLine.substr(0, sp1);
+      req.path = requestLine.substr(sp1 + 1, sp2 - sp1 - 1);
+      req.body.clear();
+
+      size_t contentLength = 0;
+      bool chunked = false, expectContinue = false;
+      req.keepAlive = requestLine.find("HTTP/1.0") == std::string::npos;
+      for (size_t pos = lineEnd + 2; pos < head.size();) {
+        size_t end = head.find("\r\n", pos);
+        std::string line = head.substr(pos, end - pos);
+        pos = end + 2;
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+          continue;
+        }
+        std::string name = lower(line.substr(0, colon));
+        std::string value = lower(trim(line.substr(colon + 1)));
+        if (name == "content-length") {
+          contentLength = std::stoul(value);
+        } else if (name == "transfer-encoding") {
+          chunked = value.find("chunked") != std::string::npos;
+        } else if (name == "expect") {
+          expectContinue = value == "100-continue";
+        } else if (name == "connection") {
+          req.keepAlive = value != "close";
+        }
+      }
+
+      if (expectContinue && !sendAll("HTTP/1.1 100 Continue\r\n\r\n")) {
+        return false;
+      }
+      if (chunked) {
+        return readChunked(req.body);
+      }
+      return readExactly(contentLength, req.body);
+    }
+
+    bool sendAll(const std::string &data) {
+      size_t sent = 0;
+      while (sent < data.size()) {
+        ssize_t n = send(fd_, data.data() + sent, data.size() - sent,
+                         MSG_NOSIGNAL);
+        if (n <= 0) {
+          return false;
+        }
+        sent += n;
+      }
+      return true;
+    }
+
+  private:
+    int fd_;
+    std::string buffer_;
+
+    bool fill() {
+      char chunk[16384];
+      ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+      if (n <= 0) {
+        return false;
+      }
+      buffer_.append(chunk, n);
+      return true;
+    }
+
+    bool readUntil(const char *delimiter, std::string &out) {
+      size_t pos;
+      while ((pos = buffer_.find(delimiter)) == std::string::npos) {
+        if (!fill()) {
+          return false;
+        }
+      }
+      size_t end = pos + std::strlen(delimiter);
+      out.assign(buffer_, 0, end);
+      buffer_.erase(0, end);
+      return true;
+    }
+
+    bool readExactly(size_t n, std::string &out) {
+      while (buffer_.size() < n) {
+        if (!fill()) {
+          return false;
+        }
+      }
+      out.append(buffer_, 0, n);
+      buffer_.erase(0, n);
+      return true;
+    }
+
+    bool readChunked(std::string &out) {
+      for (;;) {
+        std::string sizeLine;
+        if (!readUntil("\r\n", sizeLine)) {
+          return false;
+        }
+        size_t size = std::stoul(sizeLine, nullptr, 16);
+        std::string crlf;
+        if (size == 0) {
+          // Skip trailers up to the blank line that ends the body.
+          while (readUntil("\r\n", crlf) && crlf != "\r\n") {
+          }
+          return true;
+        }
+        if (!readExactly(size, out) || !readExactly(2, crlf)) {
+          return false;
+        }
+      }
+    }
+
+    static std::string lower(std::string s) {
+      for (char &c : s) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+      }
+      return s;
+    }
+
+    static std::string trim(const std::string &s) {
+      size_t begin = s.find_first_not_of(" \t");
+      size_t end = s.find_last_not_of(" \t");
+      return begin == std::string::npos ? "" : s.substr(begin, end - begin + 1);
+    }
+  };
+
+  SimBehaviour behaviour_;
+  std::atomic<bool> running_{false};
+  std::atomic<size_t> requests_{0};
+  int listenFd_ = -1;
+  uint16_t port_ = 0;
+  std::thread acceptor_;
+  std::mutex mutex_;
+  std::condition_variable drained_;
+  std::vector<int> clients_; // one per live connection thread
+
+  void acceptLoop() {
+    while (running_) {
+      int fd = accept(listenFd_, nullptr, nullptr);
+      if (fd < 0) {
+        continue;
+      }
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!running_) {
+        close(fd);
+        break;
+      }
+      try {
+        std::thread([this, fd] { serve(fd); }).detach();
+      } catch (const std::system_error &) {
+        close(fd); // out of threads; the client sees a reset and retries
+        continue;
+      }
+      clients_.push_back(fd);
+    }
+  }
+
+  void serve(int fd) {
+    Connection conn(fd);
+    std::mt19937_64 rng(std::random_device{}() ^ fd);
+    std::uniform_real_distribution<double> unit(0, 1);
+    Request req;
+
+    while (running_ && conn.readRequest(req)) {
+      requests_++;
+      SimBehaviour b;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        b = behaviour_;
+      }
+
+      bool stt = req.path.rfind("/speech/recognition/", 0) == 0;
+      double delayMs = b.latencyMs + b.jitterMs * (2 * unit(rng) - 1);
+      if (stt) {
+        // 16kHz 16-bit mono
+        delayMs += b.latencyPerAudioSecondMs * req.body.size() / 32000.0;
+      }
+      if (unit(rng) < b.stragglerRate) {
+        delayMs += b.stragglerMs;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(
+          static_cast<long>(std::max(delayMs, 0.0) * 1000)));
+
+      bool ok;
+      if (unit(rng) < b.failureRate) {
+        ok = respond(conn, 503, "text/plain", "injected failure",
+                     req.keepAlive);
+      } else if (req.method == "POST" && stt && b.assessmentBody) {
+        ok = respond(conn, 200, "application/json", *b.assessmentBody,
+                     req.keepAlive, b.responseChunkBytes, b.chunkDelayMs);
+      } else if (req.method == "POST" &&
+                 req.path.rfind("/cognitiveservices/v1", 0) == 0) {
+        ok = respond(conn, 200, "audio/mpeg", std::string(b.audioBytes, '\x55'),
+                     req.keepAlive, b.responseChunkBytes, b.chunkDelayMs);
+      } else {
+        ok = respond(conn, 404, "text/plain", "no such route", req.keepAlive);
+      }
+      if (!ok || !req.keepAlive) {
+        break;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    clients_.erase(std::find(clients_.begin(), clients_.end(), fd));
+    close(fd);
+    if (clients_.empty()) {
+      drained_.notify_all();
+    }
+  }
+
+  static bool respond(Connection &conn, int status, const char *contentType,
+                      const std::string &body, bool keepAlive,
+                      size_t chunkBytes = 0, double chunkDelayMs = 0) {
+    std::string reason = status == 200   ? "OK"
+                         : status == 404 ? "Not Found"
+                                         : "Service Unavailable";
+    std::string head = "HTTP/1.1 " + std::to_string(status) + " " + reason +
+                       "\r\nContent-Type: " + contentType + "\r\n" +
+                       (keepAlive ? "" : "Connection: close\r\n");
+    if (chunkBytes == 0) {
+      head += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+      return conn.sendAll(head) && conn.sendAll(body);
+    }
+
+    head += "Transfer-Encoding: chunked\r\n\r\n";
+    if (!conn.sendAll(head)) {
+      return false;
+    }
+    char size[32];
+    for (size_t pos = 0; pos < body.size(); pos += chunkBytes) {
+      if (pos > 0 && chunkDelayMs > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(
+            static_cast<long>(chunkDelayMs * 1000)));
+      }
+      size_t n = std::min(chunkBytes, body.size() - pos);
+      snprintf(size, sizeof(size), "%zx\r\n", n);
+      if (!conn.sendAll(size) || !conn.sendAll(body.substr(pos, n)) ||
+          !conn.sendAll("\r\n")) {
+        return false;
+      }
+    }
+    return conn.sendAll("0\r\n\r\n");
+  }
+};
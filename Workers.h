@@ -0,0 +1,183 @@
+#pragma once
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace workers {
+
+struct Options {
+  int workers = 1;
+  // Threads per worker for crow; 1 keeps each worker on its own core.
+  int threadsPerWorker = 1;
+  bool pinCores = true;
+  // A worker that dies sooner than this after starting is restarted with a
+  // growing delay instead of straight away.
+  std::chrono::milliseconds minUptime{1000};
+  std::chrono::milliseconds maxRestartDelay{5000};
+};
+
+// Pins the calling process to one CPU of `allowed`, the mask the server was
+// started with, so workers stay inside a taskset or cpuset they were given.
+inline void pinToCore(int index, const cpu_set_t &allowed) {
+  int count = CPU_COUNT(&allowed);
+  if (count == 0) {
+    return;
+  }
+  int nth = index % count;
+  int cpu = 0;
+  for (; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &allowed) && nth-- == 0) {
+      break;
+    }
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    std::cerr << "worker " << index << ": cannot pin to core: "
+              << strerror(errno) << std::endl;
+  }
+}
+
+// Forks opts.workers processes that each call serve(index) and keeps them
+// running: a worker that exits is started again until the supervisor gets
+// SIGINT or SIGTERM, which it forwards before waiting for the workers to
+// finish. Must be called before any threads are started.
+inline int supervise(const Options &opts, const std::function<void(int)> &serve) {
+  using Clock = std::chrono::steady_clock;
+
+  struct Worker {
+    pid_t pid = 0;
+    Clock::time_point startedAt;
+    Clock::time_point restartAt;
+    std::chrono::milliseconds backoff{0};
+  };
+  std::vector<Worker> pool(opts.workers);
+
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (opts.pinCores && sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    std::cerr << "cannot read CPU affinity, workers left unpinned: "
+              << strerror(errno) << std::endl;
+    CPU_ZERO(&allowed);
+  }
+
+  sigset_t signals, previous;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigprocmask(SIG_BLOCK, &signals, &previous);
+
+  auto spawn = [&](int index) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::cerr << "fork failed: " << strerror(errno) << std::endl;
+      pool[index].restartAt = Clock::now() + opts.maxRestartDelay;
+      return;
+    }
+    if (pid == 0) {
+      sigprocmask(SIG_SETMASK, &previous, nullptr);
+      if (opts.pinCores) {
+        pinToCore(index, allowed);
+      }
+      serve(index);
+      std::_Exit(0);
+    }
+    pool[index].pid = pid;
+    pool[index].startedAt = Clock::now();
+  };
+
+  for (int i = 0; i < opts.workers; i++) {
+    spawn(i);
+  }
+
+  auto anyAlive = [&]() {
+    for (const Worker &w : pool) {
+      if (w.pid > 0) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  bool stopping = false;
+  while (!stopping || anyAlive()) {
+    // Wake up for the next scheduled restart even if no signal arrives.
+    auto wakeAt = Clock::now() + std::chrono::seconds(1);
+    for (const Worker &w : pool) {
+      if (w.pid == 0 && !stopping) {
+        wakeAt = std::min(wakeAt, w.restartAt);
+      }
+    }
+    auto wait = std::max<Clock::duration>(wakeAt - Clock::now(),
+                                          Clock::duration::zero());
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(wait);
+    timespec timeout{
+        static_cast<time_t>(secs.count()),
+        static_cast<long>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(wait - secs)
+                .count())};
+
+    int sig = sigtimedwait(&signals, nullptr, &timeout);
+    if ((sig == SIGINT || sig == SIGTERM) && !stopping) {
+      stopping = true;
+      for (const Worker &w : pool) {
+        if (w.pid > 0) {
+          kill(w.pid, SIGTERM);
+        }
+      }
+    }
+
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      for (size_t i = 0; i < pool.size(); i++) {
+        Worker &w = pool[i];
+        if (w.pid != pid) {
+          continue;
+        }
+        w.pid = 0;
+        if (stopping) {
+          break;
+        }
+        std::cerr << "worker " << i << " (pid " << pid << ") exited with "
+                  << (WIFSIGNALED(status) ? "signal " : "status ")
+                  << (WIFSIGNALED(status) ? WTERMSIG(status)
+                                          : WEXITSTATUS(status))
+                  << ", restarting" << std::endl;
+        if (Clock::now() - w.startedAt < opts.minUptime) {
+          w.backoff = std::min(
+              std::max(w.backoff * 2, std::chrono::milliseconds(100)),
+              opts.maxRestartDelay);
+        } else {
+          w.backoff = std::chrono::milliseconds(0);
+        }
+        w.restartAt = Clock::now() + w.backoff;
+        break;
+      }
+    }
+
+    if (!stopping) {
+      for (size_t i = 0; i < pool.size(); i++) {
+        if (pool[i].pid == 0 && Clock::now() >= pool[i].restartAt) {
+          spawn(static_cast<int>(i));
+        }
+      }
+    }
+  }
+
+  sigprocmask(SIG_SETMASK, &previous, nullptr);
+  return 0;
+}
+
+} // namespace workers
+
@@ -0,0 +1,142 @@
+// Count every heap allocation so the two parsers can be compared on
+// allocations per response as well as time.
+#define BENCH_COUNT_ALLOCATIONS
+
+#include "Assessment.h"
+#include "Bench.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+const std::vector<std::string> fixtures = {"fixtures/assessment_short.json",
+                                           "fixtures/assessment_read_aloud.json"};
+
+// What pronoun.cpp would have to do with a DOM: parse everything, then pick
+// the same fields out of the tree.
+void extractFromDom(const json &doc, AssessmentResult &out) {
+  out.clear();
+  out.recognitionStatus =
+      out.store(doc.at("RecognitionStatus").get<std::string>());
+  const json &best = doc.at("NBest").at(0);
+  const json &scores = best.contains("PronunciationAssessment")
+                           ? best.at("PronunciationAssessment")
+                           : best;
+  out.accuracy = scores.value("AccuracyScore", 0.0);
+  out.fluency = scores.value("FluencyScore", 0.0);
+  out.completeness = scores.value("CompletenessScore", 0.0);
+  out.prosody = scores.value("ProsodyScore", 0.0);
+  out.pronunciation = scores.value("PronScore", 0.0);
+  for (const json &w : best.at("Words")) {
+    const json &ws =
+        w.contains("PronunciationAssessment") ? w.at("PronunciationAssessment")
+                                              : w;
+    WordAssessment &word = out.words.emplace_back();
+    word.word = out.store(w.at("Word").get<std::string>());
+    word.errorType = out.store(ws.value("ErrorType", std::string()));
+    word.accuracy = ws.value("AccuracyScore", 0.0);
+    word.offset = w.value("Offset", uint64_t{0});
+    word.duration = w.value("Duration", uint64_t{0});
+    for (const json &p : w.value("Phonemes", json::array())) {
+      const json &ps = p.contains("PronunciationAssessment")
+                           ? p.at("PronunciationAssessment")
+                           : p;
+      PhonemeAssessment &phoneme = out.phonemes.emplace_back();
+      phoneme.phoneme = out.store(p.at("Phoneme").get<std::string>());
+      phoneme.accuracy = ps.value("AccuracyScore", 0.0);
+    }
+  }
+}
+
+bool sameResult(const AssessmentResult &a, const AssessmentResult &b) {
+  if (a.recognitionStatus != b.recognitionStatus || a.accuracy != b.accuracy ||
+      a.fluency != b.fluency || a.completeness != b.completeness ||
+      a.prosody != b.prosody || a.pronunciation != b.pronunciation ||
+      a.words.size() != b.words.size() ||
+      a.phonemes.size() != b.phonemes.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.phonemes.size(); i++) {
+    if (a.phonemes[i].phoneme != b.phonemes[i].phoneme ||
+        a.phonemes[i].accuracy != b.phonemes[i].accuracy) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < a.words.size(); i++) {
+    const WordAssessment &x = a.words[i], &y = b.words[i];
+    if (x.word != y.word || x.errorType != y.errorType ||
+        x.accuracy != y.accuracy || x.offset != y.offset ||
+        x.duration != y.duration) {
+      return false;
+    }
+  }
+  return true;
+}
+
+struct Measurement {
+  double nsPerOp;
+  double allocsPerOp;
+};
+
+template <typename Fn> Measurement measure(size_t iterations, Fn &&fn) {
+  fn(); // warm up buffers and the arena
+  size_t allocsBefore = bench::threadAllocations.count;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    fn();
+  }
+  auto end = std::chrono::steady_clock::now();
+  size_t allocs = bench::threadAllocations.count - allocsBefore;
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  return {ns / iterations, static_cast<double>(allocs) / iterations};
+}
+
+int main(int argc, char **argv) {
+  size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+
+  std::cout << std::left << std::setw(40) << "fixture" << std::right
+            << std::setw(10) << "bytes" << std::setw(14) << "dom us/op"
+            << std::setw(14) << "dom allocs" << std::setw(14) << "sax us/op"
+            << std::setw(14) << "sax allocs" << std::setw(10) << "speedup"
+            << std::endl;
+
+  for (const std::string &path : fixtures) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      std::cerr << "Fixture not found: " << path << std::endl;
+      return 1;
+    }
+    std::string body((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+
+    AssessmentResult viaDom, viaSax;
+    extractFromDom(json::parse(body), viaDom);
+    if (!assessment::parse(body, viaSax) || !sameResult(viaDom, viaSax)) {
+      std::cerr << "Streaming parser disagrees with DOM on " << path
+                << std::endl;
+      return 1;
+    }
+
+    Measurement dom = measure(
+        iterations, [&] { extractFromDom(json::parse(body), viaDom); });
+    Measurement sax =
+        measure(iterations, [&] { assessment::parse(body, viaSax); });
+
+    std::cout << std::left << std::setw(40) << path << std::right
+              << std::setw(10) << body.size() << std::fixed
+              << std::setprecision(1) << std::setw(14) << dom.nsPerOp / 1000
+              << std::setw(14) << dom.allocsPerOp << std::setw(14)
+              << sax.nsPerOp / 1000 << std::setw(14) << sax.allocsPerOp
+              << std::setw(9) << std::setprecision(2)
+              << dom.nsPerOp / sax.nsPerOp << "x" << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,275 @@
+#include "Bench.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Closed-loop HTTP load generator for auth_server: each connection sends its
+// next keep-alive request as soon as the previous response arrives. A few
+// epoll threads drive all connections, so the generator needs little CPU of
+// its own next to the server it measures. Defaults to POST /auth/login for a
+// user it signs up first, which exercises SQLite and password hashing on
+// every request. Prints requests/sec and latency percentiles as JSON.
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+int connectTo(const std::string &host, int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+// Takes one complete response off the front of `buffer`. Returns its status
+// code, or 0 if the response has not fully arrived yet.
+int takeResponse(std::string &buffer) {
+  size_t headerEnd = buffer.find("\r\n\r\n");
+  if (headerEnd == std::string::npos) {
+    return 0;
+  }
+  size_t contentLength = 0;
+  std::string head = buffer.substr(0, headerEnd);
+  for (char &c : head) {
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+  size_t cl = head.find("content-length:");
+  if (cl != std::string::npos) {
+    contentLength = std::strtoul(head.c_str() + cl + 15, nullptr, 10);
+  }
+  size_t total = headerEnd + 4 + contentLength;
+  if (buffer.size() < total) {
+    return 0;
+  }
+  int status = std::atoi(buffer.c_str() + buffer.find(' ') + 1);
+  buffer.erase(0, total);
+  return status;
+}
+
+std::string makeRequest(const std::string &method, const std::string &path,
+                        const std::string &host, const std::string &body) {
+  return method + " " + path + " HTTP/1.1\r\nHost: " + host +
+         "\r\nContent-Type: application/json\r\n"
+         "Content-Length: " +
+         std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+// Sends one request on a fresh connection and waits for the status.
+int roundTrip(const std::string &host, int port, const std::string &request) {
+  int fd = connectTo(host, port);
+  if (fd < 0) {
+    return -1;
+  }
+  int status = -1;
+  if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) ==
+      static_cast<ssize_t>(request.size())) {
+    std::string buffer;
+    char chunk[8192];
+    ssize_t n;
+    while ((status = takeResponse(buffer)) == 0 &&
+           (n = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+      buffer.append(chunk, n);
+    }
+    status = status == 0 ? -1 : status;
+  }
+  close(fd);
+  return status;
+}
+
+struct Connection {
+  int fd = -1;
+  std::string buffer;
+  Clock::time_point sentAt;
+};
+
+struct ThreadResult {
+  std::vector<double> latencies;
+  size_t errors = 0;
+};
+
+// Drives `count` connections from one epoll loop until `running` clears.
+void drive(const std::string &host, int port, const std::string &request,
+           int count, const std::atomic<bool> &running, ThreadResult &result) {
+  int epfd = epoll_create1(0);
+  std::vector<Connection> conns(count);
+
+  auto open = [&](int i) {
+    Connection &c = conns[i];
+    c.buffer.clear();
+    while (running && (c.fd = connectTo(host, port)) < 0) {
+      result.errors++;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (c.fd < 0) {
+      return;
+    }
+    fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL) | O_NONBLOCK);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u32 = static_cast<uint32_t>(i);
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+  };
+  auto reopen = [&](int i) {
+    result.errors++;
+    close(conns[i].fd);
+    conns[i].fd = -1;
+    open(i);
+  };
+  // Requests are small enough to fit the socket buffer in one send.
+  auto fire = [&](int i) {
+    Connection &c = conns[i];
+    while (running && c.fd >= 0) {
+      c.sentAt = Clock::now();
+      if (send(c.fd, request.data(), request.size(), MSG_NOSIGNAL) ==
+          static_cast<ssize_t>(request.size())) {
+        return;
+      }
+      reopen(i);
+    }
+  };
+
+  for (int i = 0; i < count; i++) {
+    open(i);
+    fire(i);
+  }
+
+  std::vector<epoll_event> events(std::max(count, 1));
+  char chunk[16384];
+  while (running) {
+    int n = epoll_wait(epfd, events.data(), static_cast<int>(events.size()), 100);
+    for (int e = 0; e < n; e++) {
+      int i = static_cast<int>(events[e].data.u32);
+      Connection &c = conns[i];
+      ssize_t got;
+      while ((got = recv(c.fd, chunk, sizeof(chunk), 0)) > 0) {
+        c.buffer.append(chunk, got);
+      }
+      if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        reopen(i);
+        fire(i);
+        continue;
+      }
+      int status = takeResponse(c.buffer);
+      if (status == 0) {
+        continue;
+      }
+      if (status >= 400) {
+        result.errors++;
+      }
+      result.latencies.push_back(
+          std::chrono::duration<double, std::milli>(Clock::now() - c.sentAt)
+              .count());
+      fire(i);
+    }
+  }
+
+  for (Connection &c : conns) {
+    if (c.fd >= 0) {
+      close(c.fd);
+    }
+  }
+  close(epfd);
+}
+
+int main(int argc, char **argv) {
+  auto flags = bench::parseFlags(argc, argv);
+  auto text = [&](const char *name, const std::string &fallback) {
+    auto it = flags.find(name);
+    return it == flags.end() ? fallback : it->second;
+  };
+
+  std::string host = text("host", "127.0.0.1");
+  int port = std::atoi(text("port", "8080").c_str());
+  std::string user = text("user", "bench_user");
+  std::string password = text("password", "BenchPass1");
+  std::string method = text("method", "POST");
+  std::string path = text("path", "/auth/login");
+  std::string body = text(
+      "body", json{{"username", user}, {"password", password}}.dump());
+  int connections = std::atoi(text("connections", "64").c_str());
+  int threads = std::max(1, std::atoi(text("threads", "2").c_str()));
+  double seconds = std::atof(text("duration", "10").c_str());
+
+  // The login target needs its user to exist; 409 means an earlier run
+  // already created it.
+  if (text("seed", "1") != "0") {
+    std::string signup = json{{"username", user},
+                              {"password", password},
+                              {"email", user + "@example.com"}}
+                             .dump();
+    int status = roundTrip(host, port,
+                           makeRequest("POST", "/auth/signup", host, signup));
+    if (status != 201 && status != 409) {
+      std::cerr << "Cannot create " << user << " (status " << status << ")"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  std::string request = makeRequest(method, path, host, body);
+  std::atomic<bool> running{true};
+  std::vector<ThreadResult> results(threads);
+  std::vector<std::thread> pool;
+
+  auto start = Clock::now();
+  for (int t = 0; t < threads; t++) {
+    int count = connections / threads + (t < connections % threads ? 1 : 0);
+    pool.emplace_back([&, t, count] {
+      drive(host, port, request, count, running, results[t]);
+    });
+  }
+
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  running = false;
+  for (std::thread &t : pool) {
+    t.join();
+  }
+  double elapsed =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::vector<double> all;
+  size_t errorCount = 0;
+  for (const ThreadResult &r : results) {
+    all.insert(all.end(), r.latencies.begin(), r.latencies.end());
+    errorCount += r.errors;
+  }
+  std::sort(all.begin(), all.end());
+  auto at = [&](double p) {
+    return all.empty() ? 0.0 : all[static_cast<size_t>(p * (all.size() - 1))];
+  };
+
+  json report = {{"target", host + ":" + std::to_string(port) + path},
+                 {"method", method},
+                 {"connections", connections},
+                 {"threads", threads},
+                 {"seconds", elapsed},
+                 {"requests", all.size()},
+                 {"errors", errorCount},
+                 {"requestsPerSecond", all.size() / elapsed},
+                 {"latencyMs",
+                  {{"p50", at(0.50)}, {"p90", at(0.90)}, {"p99", at(0.99)}}}};
+  std::cout << report.dump() << std::endl;
+  return 0;
+}
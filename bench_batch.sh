@@ -0,0 +1,51 @@
+#!/bin/bash
+# Grades a generated mock exam against a local upstream_sim: once one item at
+# a time, once through the pipeline, and once killed halfway and resumed from
+# where it left off. Build first:
+#   g++ -std=c++20 -O2 -o pro pronoun.cpp -lcurl -lsqlite3 -lpthread
+#   g++ -std=c++20 -O2 -o upstream_sim upstream_sim.cpp -lpthread
+# Usage: ./bench_batch.sh [items] [uploads] [latency_ms] [audio]
+
+items=${1:-200}
+uploads=${2:-8}
+latency=${3:-200}
+audio=${4:-$PWD/meow.pcm}
+port=8091
+
+dir=$(mktemp -d)
+./upstream_sim --port "$port" --latency "$latency" --jitter 20 >/dev/null &
+sim=$!
+sleep 1
+kill -0 "$sim" 2>/dev/null || exit 1
+trap 'kill "$sim"; rm -rf "$dir"' EXIT
+export STT_ENDPOINT=http://127.0.0.1:$port
+
+for i in $(seq "$items"); do
+  printf '%s\tmorning morning.\tlearner%d\n' "$audio" "$i"
+done >"$dir/exam.tsv"
+
+grade() {
+  ./pro --batch "$dir/exam.tsv" --db "$dir/auth.db" "$@" | head -1
+}
+
+# Each run starts from an empty database, since it remembers finished items.
+fresh() {
+  rm -f "$dir"/auth.db*
+}
+
+fresh
+echo "sequential: $(grade --workers 1 --uploads 1)"
+fresh
+echo "pipelined:  $(grade --uploads "$uploads")"
+
+fresh
+half=$(awk -v n="$items" -v u="$uploads" -v l="$latency" \
+  'BEGIN { printf "%.1f", n * l / u / 2000 }')
+./pro --batch "$dir/exam.tsv" --db "$dir/auth.db" --uploads "$uploads" \
+  >/dev/null &
+pro=$!
+sleep "$half"
+kill -KILL "$pro"
+wait "$pro" 2>/dev/null
+echo "killed after ${half}s"
+echo "resumed:    $(grade --uploads "$uploads")"
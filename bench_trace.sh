@@ -0,0 +1,34 @@
+#!/bin/bash
+# Measures what the tracing instrumentation costs on the login path: a build
+# with the macros compiled out against the instrumented build with sampling
+# off, at 1% and at 100%. Extra arguments are passed to g++ (e.g. -I paths).
+# Usage: ./bench_trace.sh [requests] [rounds] [g++ flags...]
+
+requests=${1:-20000}
+rounds=${2:-5}
+shift $(($# < 2 ? $# : 2))
+
+build() {
+  g++ -std=c++20 -O2 "$@" -o "$out" trace_bench.cpp -lpthread -lsqlite3 -lcrypto -lssl
+}
+
+out=trace_bench_off build -DPTE_TRACE_DISABLED "$@" || exit 1
+out=trace_bench build "$@" || exit 1
+
+field() {
+  sed "s/.*\"$1\":\([0-9.e+-]*\).*/\1/"
+}
+
+report=$(./trace_bench_off --requests "$requests" --rounds "$rounds")
+baseline=$(echo "$report" | field nsPerRequest)
+printf "compiled out: %.0f ns/request\n" "$baseline"
+for rate in 0 0.01 1; do
+  report=$(./trace_bench --requests "$requests" --rounds "$rounds" --rate "$rate")
+  awk -v rate="$rate" -v base="$baseline" \
+    -v t="$(echo "$report" | field nsPerRequest)" \
+    -v empty="$(echo "$report" | field nsPerEmptyRequest)" 'BEGIN {
+    printf "sample rate %s: %.0f ns/request (%+.2f%% overhead), %.1f ns per root+span\n",
+      rate, t, (t - base) * 100 / base, empty
+  }'
+done
+rm -f trace_bench_off trace_bench
@@ -0,0 +1,45 @@
+#!/bin/bash
+# Compares requests/sec of the single-process server against 1..N
+# SO_REUSEPORT workers on the login route, which hits SQLite and hashes a
+# password on every request. The server is confined to the first
+# `server_cores` cores and auth_bench to the rest, so the generator does not
+# compete with the workers it measures. Build first:
+#   g++ -std=c++20 -O2 -o auth_server main.cpp -lpthread -ljwt -lsqlite3 -lcrypto -lssl
+#   g++ -std=c++20 -O2 -o auth_bench auth_bench.cpp -lpthread
+# Usage: ./bench_workers.sh [server_cores] [seconds] [path]
+
+cores=$(nproc)
+server_cores=${1:-$((cores > 1 ? cores / 2 : 1))}
+seconds=${2:-10}
+path=${3:-/auth/login}
+connections=$((server_cores * 32))
+
+server_set="0-$((server_cores - 1))"
+if [ "$server_cores" -lt "$cores" ]; then
+  bench_set="$server_cores-$((cores - 1))"
+else
+  echo "warning: no cores left for auth_bench, it shares the server's" >&2
+  bench_set="0-$((cores - 1))"
+fi
+bench_threads=$(((cores - server_cores) > 1 ? cores - server_cores : 1))
+
+run() {
+  label=$1
+  shift
+  env "$@" taskset -c "$server_set" ./auth_server >/dev/null 2>&1 &
+  server=$!
+  sleep 1
+  echo "$label $(taskset -c "$bench_set" ./auth_bench --path "$path" \
+    --duration "$seconds" --connections "$connections" \
+    --threads "$bench_threads")"
+  kill -TERM "$server"
+  wait "$server" 2>/dev/null
+}
+
+echo "server on cores $server_set, auth_bench on $bench_set"
+run "multithreaded" AUTH_WORKERS=0
+workers=1
+while [ "$workers" -le "$server_cores" ]; do
+  run "workers=$workers" AUTH_WORKERS=$workers
+  workers=$((workers * 2))
+done
@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""Generates the assessment_*.json fixtures.
+
+These are synthetic: no captured Azure response is available to commit. They
+follow the shape of a detailed-format pronunciation assessment response
+(two NBest entries; per-word scores, prosody feedback, syllables and phonemes
+with NBestPhonemes, all nested under "PronunciationAssessment") and use the
+SAPI phone set with dictionary pronunciations, but every score, timing and
+confidence is made up. Regenerate with:
+
+    python3 fixtures/make_fixtures.py
+"""
+
+import json
+import os
+import random
+
+# Dictionary pronunciations, syllables separated by "|".
+LEXICON = {
+    "although": "ao l | dh ow",
+    "and": "ae n d",
+    "bar": "b aa r",
+    "between": "b ih | t w iy n",
+    "chart": "ch aa r t",
+    "costs": "k ao s t s",
+    "countries": "k ah n | t r iy z",
+    "country": "k ah n | t r iy",
+    "decades": "d eh | k ey d z",
+    "declined": "d ih | k l ay n d",
+    "different": "d ih f | r ax n t",
+    "every": "eh v | r iy",
+    "expenses": "ih k | s p eh n | s ih z",
+    "final": "f ay | n ax l",
+    "five": "f ay v",
+    "food": "f uw d",
+    "four": "f ao r",
+    "household": "h aw s | h ow l d",
+    "housing": "h aw | z ih ng",
+    "illustrates": "ih | l ax | s t r ey t s",
+    "in": "ih n",
+    "income": "ih n | k ah m",
+    "increased": "ih n | k r iy s t",
+    "morning": "m ao r | n ih ng",
+    "nineteen": "n ay n | t iy n",
+    "ninety": "n ay n | t iy",
+    "of": "ah v",
+    "on": "aa n",
+    "over": "ow | v er",
+    "overall": "ow | v er | ao l",
+    "period": "p ih r | iy | ax d",
+    "proportion": "p r ax | p ao r | sh ax n",
+    "relatively": "r eh | l ax | t ih v | l iy",
+    "remained": "r ih | m ey n d",
+    "rose": "r ow z",
+    "share": "sh eh r",
+    "significantly": "s ih g | n ih f | ih | k ax n t | l iy",
+    "slightly": "s l ay t | l iy",
+    "spent": "s p eh n t",
+    "stable": "s t ey | b ax l",
+    "steadily": "s t eh | d ax | l iy",
+    "ten": "t eh n",
+    "the": "dh ax",
+    "they": "dh ey",
+    "thousand": "th aw | z ax n d",
+    "transport": "t r ae n s | p ao r t",
+    "two": "t uw",
+    "while": "w ay l",
+    "years": "y ih r z",
+}
+
+PHONES = sorted({p for pron in LEXICON.values() for p in pron.split() if p != "|"})
+
+# Sounds a learner plausibly substitutes for each other; used for the
+# runner-up NBestPhonemes and for mispronounced words.
+CONFUSIONS = {
+    "th": ["s", "t", "f"], "dh": ["d", "z", "v"], "ih": ["iy", "eh"],
+    "iy": ["ih", "ey"], "ae": ["eh", "aa"], "ax": ["ah", "eh"],
+    "r": ["l", "w"], "l": ["r"], "v": ["w", "b"], "w": ["v"],
+    "z": ["s"], "sh": ["s", "ch"], "ng": ["n"], "er": ["aa", "ax"],
+}
+
+
+def grapheme_split(word, syllables):
+    """Splits the spelling roughly in proportion to each syllable's phonemes."""
+    total = sum(len(s) for s in syllables)
+    out, start, seen = [], 0, 0
+    for i, s in enumerate(syllables):
+        seen += len(s)
+        end = len(word) if i == len(syllables) - 1 else round(len(word) * seen / total)
+        end = max(end, start + 1)
+        out.append(word[start:end])
+        start = end
+    return out
+
+
+def nbest_phonemes(rng, phone):
+    candidates = CONFUSIONS.get(phone, []) + rng.sample(PHONES, 6)
+    runners = [p for p in dict.fromkeys(candidates) if p != phone][:4]
+    scores = sorted((round(rng.uniform(0, 60), 1) for _ in runners), reverse=True)
+    return [{"Phoneme": phone, "Score": 100}] + [
+        {"Phoneme": p, "Score": s} for p, s in zip(runners, scores)
+    ]
+
+
+def word_entry(rng, word, offset, error_type):
+    syllables = [s.split() for s in LEXICON[word].split("|")]
+    weak = error_type == "Mispronunciation"
+    phone_ticks = 800000
+    phonemes, syllable_entries = [], []
+    t = offset
+    for syllable, grapheme in zip(syllables, grapheme_split(word, syllables)):
+        start = t
+        scores = []
+        for phone in syllable:
+            score = round(rng.uniform(30, 65) if weak and rng.random() < 0.5
+                          else rng.uniform(70, 100), 1)
+            scores.append(score)
+            phonemes.append({
+                "Phoneme": phone,
+                "PronunciationAssessment": {
+                    "AccuracyScore": score,
+                    "NBestPhonemes": nbest_phonemes(rng, phone),
+                },
+                "Offset": t,
+                "Duration": phone_ticks,
+            })
+            t += phone_ticks + 100000
+        syllable_entries.append({
+            "Syllable": "".join(syllable),
+            "Grapheme": grapheme,
+            "PronunciationAssessment": {"AccuracyScore": round(sum(scores) / len(scores), 1)},
+            "Offset": start,
+            "Duration": t - start - 100000,
+        })
+    accuracy = round(sum(p["PronunciationAssessment"]["AccuracyScore"]
+                         for p in phonemes) / len(phonemes), 1)
+    entry = {
+        "Word": word,
+        "Offset": offset,
+        "Duration": t - offset - 100000,
+        "Confidence": 0,
+        "PronunciationAssessment": {
+            "AccuracyScore": accuracy,
+            "ErrorType": error_type,
+            "Feedback": {
+                "Prosody": {
+                    "Break": {
+                        "ErrorTypes": [error_type if "Break" in error_type else "None"],
+                        "UnexpectedBreak": {"Confidence": round(rng.random(), 8)},
+                        "MissingBreak": {"Confidence": round(rng.random(), 8)},
+                        "BreakLength": 0,
+                    },
+                    "Intonation": {
+                        "ErrorTypes": ["Monotone"] if error_type == "Monotone" else [],
+                        "Monotone": {"SyllablePitchDeltaConfidence": round(rng.random(), 8)},
+                    },
+                }
+            },
+        },
+        "Syllables": syllable_entries,
+        "Phonemes": phonemes,
+    }
+    return entry, t + 300000
+
+
+def response(rng, display, errors, nbest_scores):
+    words = [w.strip(".,").lower() for w in display.split()]
+    lexical = " ".join(words)
+    nbest = []
+    for rank, scores in enumerate(nbest_scores):
+        offset, entries = 700000, []
+        for i, word in enumerate(words):
+            entry, offset = word_entry(rng, word, offset,
+                                       errors.get(i, "None") if rank == 0 else "None")
+            entries.append(entry)
+        nbest.append({
+            "Confidence": round(0.95 - 0.1 * rank, 2),
+            "Lexical": lexical,
+            "ITN": lexical,
+            "MaskedITN": lexical,
+            "Display": display,
+            "PronunciationAssessment": dict(zip(
+                ["AccuracyScore", "FluencyScore", "ProsodyScore",
+                 "CompletenessScore", "PronScore"], scores)),
+            "Words": entries,
+        })
+    return {
+        "RecognitionStatus": "Success",
+        "Offset": 700000,
+        "Duration": offset - 700000,
+        "DisplayText": display,
+        "SNR": round(rng.uniform(25, 35), 6),
+        "NBest": nbest,
+    }
+
+
+READ_ALOUD = (
+    "The bar chart illustrates the proportion of household income spent on "
+    "food, housing and transport in four different countries between nineteen "
+    "ninety and two thousand ten. Overall, housing costs rose steadily in every "
+    "country, while the share spent on food declined significantly over the two "
+    "decades. Transport expenses remained relatively stable, although they "
+    "increased slightly in the final five years of the period."
+)
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    rng = random.Random(2024)
+    fixtures = {
+        "assessment_short.json": response(
+            rng, "Morning morning.", {0: "Mispronunciation"},
+            [[93.4, 76.7, 99, 96, 92], [88.0, 74.2, 95.1, 96, 87.5]]),
+        "assessment_read_aloud.json": response(
+            rng, READ_ALOUD,
+            {13: "Mispronunciation", 29: "UnexpectedBreak", 34: "Monotone",
+             35: "Mispronunciation", 40: "Mispronunciation", 48: "Omission",
+             54: "MissingBreak", 60: "Mispronunciation"},
+            [[85.4, 84.8, 81.3, 90.3, 70.1], [82.9, 84.8, 80.0, 90.3, 68.7]]),
+    }
+    for name, body in fixtures.items():
+        with open(os.path.join(here, name), "w") as f:
+            json.dump(body, f)
+
+
+if __name__ == "__main__":
+    main()
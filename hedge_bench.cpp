@@ -0,0 +1,157 @@
+#include "Speech.h"
+#include "Upstream.h"
+#include "UpstreamSim.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <curl/curl.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Offline measurement of the upstream policy: synthesis calls against a local
+// stand-in whose latency has a straggler tail, first without and then with
+// hedging, followed by an outage to show the breaker failing fast.
+
+const std::string ssml =
+    "<speak version='1.0' xml:lang='en-US'><voice xml:lang='en-US' "
+    "xml:gender='Female' name='en-US-AvaMultilingualNeural'>my voice is my "
+    "passport verify me</voice></speak>";
+
+struct RunStats {
+  std::vector<double> latencies;
+  size_t hedged = 0;
+  size_t failed = 0;
+  size_t rejected = 0;
+};
+
+double percentile(std::vector<double> v, double p) {
+  if (v.empty()) {
+    return 0;
+  }
+  size_t rank = static_cast<size_t>(p * (v.size() - 1));
+  std::nth_element(v.begin(), v.begin() + rank, v.end());
+  return v[rank];
+}
+
+// `learners` threads each make `calls` synthesis requests back to back.
+RunStats run(Upstream &up, const UpstreamPolicy &policy, const std::string &url,
+             int learners, int calls) {
+  std::vector<RunStats> perThread(learners);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < learners; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < calls; i++) {
+        std::string bodies[2];
+        UpstreamResult r = upstream::perform(
+            up, policy,
+            [&](int attempt) {
+              CURL *curl = curl_easy_init();
+              curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+              curl_easy_setopt(curl, CURLOPT_POSTFIELDS, ssml.c_str());
+              curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, ssml.size());
+              curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,
+                               speech::appendToString);
+              curl_easy_setopt(curl, CURLOPT_WRITEDATA, &bodies[attempt]);
+              return curl;
+            },
+            true);
+        RunStats &s = perThread[t];
+        s.latencies.push_back(r.totalMs);
+        s.hedged += r.hedged;
+        s.failed += !r.ok();
+        s.rejected += r.rejected;
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  RunStats total;
+  for (const RunStats &s : perThread) {
+    total.latencies.insert(total.latencies.end(), s.latencies.begin(),
+                           s.latencies.end());
+    total.hedged += s.hedged;
+    total.failed += s.failed;
+    total.rejected += s.rejected;
+  }
+  return total;
+}
+
+void report(const std::string &label, const RunStats &s) {
+  std::cout << std::left << std::setw(12) << label << std::right << std::fixed
+            << std::setprecision(1) << std::setw(10)
+            << percentile(s.latencies, 0.50) << std::setw(10)
+            << percentile(s.latencies, 0.95) << std::setw(10)
+            << percentile(s.latencies, 0.99) << std::setw(10)
+            << *std::max_element(s.latencies.begin(), s.latencies.end())
+            << std::setw(9) << s.hedged << std::setw(9) << s.failed
+            << std::setw(9) << s.rejected << std::endl;
+}
+
+int main(int argc, char **argv) {
+  int learners = argc > 1 ? std::atoi(argv[1]) : 8;
+  int calls = argc > 2 ? std::atoi(argv[2]) : 200;
+
+  curl_global_init(CURL_GLOBAL_ALL);
+
+  SimBehaviour tail;
+  tail.latencyMs = 30;
+  tail.jitterMs = 10;
+  tail.stragglerRate = 0.03;
+  tail.stragglerMs = 1500;
+  UpstreamSim sim(tail);
+  sim.start();
+  std::string url = sim.baseUrl() + "/cognitiveservices/v1";
+
+  UpstreamPolicy plain;
+  plain.hedge = false;
+  UpstreamPolicy hedged;
+  hedged.defaultHedgeDelayMs = 100;
+
+  std::cout << learners << " learners x " << calls << " calls, "
+            << tail.stragglerRate * 100 << "% stragglers at +"
+            << tail.stragglerMs << "ms" << std::endl;
+  std::cout << std::left << std::setw(12) << "policy" << std::right
+            << std::setw(10) << "p50 ms" << std::setw(10) << "p95 ms"
+            << std::setw(10) << "p99 ms" << std::setw(10) << "max ms"
+            << std::setw(9) << "hedged" << std::setw(9) << "failed"
+            << std::setw(9) << "rejected" << std::endl;
+
+  Upstream plainUp, hedgedUp;
+  RunStats a = run(plainUp, plain, url, learners, calls);
+  report("no hedge", a);
+  RunStats b = run(hedgedUp, hedged, url, learners, calls);
+  report("hedged", b);
+  std::cout << "p99 improvement: " << std::setprecision(2)
+            << percentile(a.latencies, 0.99) / percentile(b.latencies, 0.99)
+            << "x" << std::endl;
+
+  // Outage: every request fails, slowly. Without the breaker each learner
+  // would pay the full 200ms for every failed call.
+  SimBehaviour outage = tail;
+  outage.stragglerRate = 0;
+  outage.latencyMs = 200;
+  outage.failureRate = 1;
+  sim.setBehaviour(outage);
+  UpstreamPolicy breaker = plain;
+  breaker.breakerOpenMs = 500;
+  Upstream outageUp;
+  RunStats c = run(outageUp, breaker, url, learners, 20);
+  report("outage", c);
+
+  sim.setBehaviour(tail);
+  std::this_thread::sleep_for(std::chrono::milliseconds(breaker.breakerOpenMs));
+  // The half-open breaker lets a single probe through; once it succeeds the
+  // endpoint is back in rotation for everyone.
+  run(outageUp, breaker, url, 1, 1);
+  RunStats d = run(outageUp, breaker, url, learners, 20);
+  report("recovered", d);
+
+  sim.stop();
+  curl_global_cleanup();
+  return 0;
+}
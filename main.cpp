@@ -1,19 +1,69 @@
+#include <atomic>
 #include <crow.h>
 #include <cstring>
+#include <dlfcn.h>
 #include <jwt-cpp/jwt.h>
+#include <netinet/in.h>
 #include <sqlite3.h>
+#include <sys/socket.h>
 
 #include "Database.h"
 #include "JWT.h"
+#include "Trace.h"
+#include "Workers.h"
 
-int main() {
+const uint16_t port = 8080;
+
+// Port whose listening sockets get SO_REUSEPORT; 0 leaves bind() untouched.
+std::atomic<uint16_t> reuse_port{0};
+
+uint16_t port_of(const sockaddr *addr) {
+  if (addr->sa_family == AF_INET) {
+    return ntohs(reinterpret_cast<const sockaddr_in *>(addr)->sin_port);
+  }
+  if (addr->sa_family == AF_INET6) {
+    return ntohs(reinterpret_cast<const sockaddr_in6 *>(addr)->sin6_port);
+  }
+  return 0;
+}
+
+// crow binds its acceptor itself and has no hook for socket options, so bind()
+// is wrapped for this binary: when reuse_port is set, sockets bound to that
+// port get SO_REUSEPORT first and the kernel spreads new connections across
+// every worker listening on it.
+extern "C" int bind(int fd, const sockaddr *addr, socklen_t len) {
+  using BindFn = int (*)(int, const sockaddr *, socklen_t);
+  static BindFn real_bind = reinterpret_cast<BindFn>(dlsym(RTLD_NEXT, "bind"));
+
+  uint16_t reuse = reuse_port.load(std::memory_order_relaxed);
+  if (reuse != 0 && addr && port_of(addr) == reuse) {
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+  }
+  return real_bind(fd, addr, len);
+}
+
+crow::json::rvalue parse_body(const crow::request &req) {
+  TRACE_SPAN("json.parse");
+  return crow::json::load(req.body);
+}
+
+bool is_loopback(const crow::request &req) {
+  return req.remote_ip_address == "127.0.0.1" ||
+         req.remote_ip_address == "::1";
+}
+
+// Runs one server with its own database connection. `threads` of 0 lets crow
+// use every core, which is the single-process mode.
+void run_server(int threads) {
   crow::App app;
 
   Database db{"auth.db"};
 
   CROW_ROUTE(app, "/auth/signup")
       .methods("POST"_method)([&db](const crow::request &req) {
-        auto body = crow::json::load(req.body);
+        TRACE_REQUEST("auth.signup");
+        auto body = parse_body(req);
         if (!body || !body.has("username") || !body.has("password") ||
             !body.has("email")) {
           return JsonResponse::error(
@@ -60,7 +110,8 @@ int main() {
 
   CROW_ROUTE(app, "/auth/login")
       .methods("POST"_method)([&db](const crow::request &req) {
-        auto body = crow::json::load(req.body);
+        TRACE_REQUEST("auth.login");
+        auto body = parse_body(req);
         if (!body || !body.has("username") || !body.has("password")) {
           return JsonResponse::error(400, "Missing username or password");
         }
@@ -84,15 +135,17 @@ int main() {
           std::string secret_key = Config::getInstance().getJwtSecretKey();
           int expiration_hours = Config::getInstance().getJwtExpirationHours();
 
-          auto token =
-              jwt::create()
-                  .set_issuer("auth_service")
-                  .set_type("JWS")
-                  .set_payload_claim("username", jwt::claim(user.username))
-                  .set_issued_at(std::chrono::system_clock::now())
-                  .set_expires_at(std::chrono::system_clock::now() +
-                                  std::chrono::hours(expiration_hours))
-                  .sign(jwt::algorithm::hs256{secret_key});
+          auto token = [&] {
+            TRACE_SPAN("jwt.sign");
+            return jwt::create()
+                .set_issuer("auth_service")
+                .set_type("JWS")
+                .set_payload_claim("username", jwt::claim(user.username))
+                .set_issued_at(std::chrono::system_clock::now())
+                .set_expires_at(std::chrono::system_clock::now() +
+                                std::chrono::hours(expiration_hours))
+                .sign(jwt::algorithm::hs256{secret_key});
+          }();
 
           crow::json::wvalue response;
           response["token"] = token;
@@ -105,6 +158,7 @@ int main() {
 
   CROW_ROUTE(app, "/auth/me")
       .methods("GET"_method)([&db](const crow::request &req) {
+        TRACE_REQUEST("auth.me");
         try {
           auto auth_header = req.get_header_value("Authorization");
           if (auth_header.empty() || auth_header.substr(0, 7) != "Bearer ") {
@@ -126,12 +180,118 @@ int main() {
         }
       });
 
+  CROW_ROUTE(app, "/assess/progress")
+      .methods("GET"_method)([&db](const crow::request &req) {
+        TRACE_REQUEST("assess.progress");
+        User user;
+        try {
+          auto auth_header = req.get_header_value("Authorization");
+          if (auth_header.empty() || auth_header.substr(0, 7) != "Bearer ") {
+            return JsonResponse::error(
+                401, "Missing or invalid authorization header");
+          }
+          user = validate_jwt(auth_header.substr(7), db);
+        } catch (const std::exception &e) {
+          return JsonResponse::error(
+              401, std::string("Authentication failed: ") + e.what());
+        }
+
+        try {
+          UserProgress progress = db.getProgress(user.username);
+
+          crow::json::wvalue data;
+          data["count"] = progress.count;
+          data["accuracy"] = progress.accuracy;
+          data["fluency"] = progress.fluency;
+          data["completeness"] = progress.completeness;
+          data["prosody"] = progress.prosody;
+          data["pronunciation"] = progress.pronunciation;
+          data["recentPronunciation"] = progress.recentPronunciation;
+          data["trend"] = progress.recentPronunciation - progress.pronunciation;
+          data["lastAssessedAt"] = progress.lastAssessedAt;
+
+          std::vector<crow::json::wvalue> weakest;
+          for (const PhonemeScore &p : progress.weakestPhonemes) {
+            crow::json::wvalue phoneme;
+            phoneme["phoneme"] = p.phoneme;
+            phoneme["accuracy"] = p.accuracy;
+            weakest.push_back(std::move(phoneme));
+          }
+          data["weakestPhonemes"] = std::move(weakest);
+
+          return JsonResponse::success(200, data);
+        } catch (const std::exception &e) {
+          return JsonResponse::error(500, std::string("Error: ") + e.what());
+        }
+      });
+
+  // Tracing controls, loopback only. Each worker process keeps its own rings,
+  // so in worker mode a dump covers the worker that served it.
+  CROW_ROUTE(app, "/debug/trace")
+      .methods("GET"_method, "POST"_method)([](const crow::request &req) {
+        if (!is_loopback(req)) {
+          return JsonResponse::error(403, "Forbidden");
+        }
+        if (req.method == "POST"_method) {
+          const char *rate = req.url_params.get("rate");
+          if (!rate) {
+            return JsonResponse::error(400, "Missing rate");
+          }
+          trace::setSampleRate(std::atof(rate));
+          crow::json::wvalue data;
+          data["sampleRate"] = trace::sampleRate();
+          return JsonResponse::success(200, data);
+        }
+        crow::response res(200, trace::dump());
+        res.set_header("Content-Type", "application/json");
+        return res;
+      });
+
   CROW_ROUTE(app, "/meow").methods("GET"_method)([]() {
     crow::json::wvalue response;
     response["status"] = "meow meow test";
     return crow::response(response);
   });
 
-  app.port(8080).multithreaded().run();
-  return 0;
+  app.port(port);
+  if (threads > 0) {
+    app.concurrency(threads);
+  } else {
+    app.multithreaded();
+  }
+  app.run();
+}
+
+int env_int(const char *name, int fallback) {
+  const char *value = std::getenv(name);
+  return value ? std::atoi(value) : fallback;
+}
+
+int main(int argc, char **argv) {
+  // TRACE_SAMPLE_RATE sets the initial sampling; POST /debug/trace?rate=
+  // changes it at runtime.
+  trace::initFromEnv();
+
+  // AUTH_WORKERS=N (or --workers N) runs N single-threaded worker processes,
+  // each pinned to a core and listening on the same port with SO_REUSEPORT.
+  int worker_count = env_int("AUTH_WORKERS", 0);
+  for (int i = 1; i + 1 < argc; i++) {
+    if (std::strcmp(argv[i], "--workers") == 0) {
+      worker_count = std::atoi(argv[i + 1]);
+    }
+  }
+
+  if (worker_count <= 0) {
+    run_server(0);
+    return 0;
+  }
+
+  workers::Options options;
+  options.workers = worker_count;
+  options.threadsPerWorker = env_int("AUTH_THREADS_PER_WORKER", 1);
+  options.pinCores = env_int("AUTH_PIN_CORES", 1) != 0;
+  reuse_port = port;
+  return workers::supervise(options, [&options](int) {
+    run_server(options.threadsPerWorker);
+  });
 }
@@ -0,0 +1,174 @@
+#include "Database.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Checks the incrementally maintained per-user aggregates against a full
+// recomputation. Records are added over batches of varying size for several
+// users, with enough history to wrap the recent-score ring and phonemes on
+// both sides of kMinPhonemeSamples. Then getProgress() is compared with
+// aggregate SELECTs over `assessments` and with phoneme averages computed from
+// the records themselves. Exits non-zero on the first mismatch.
+
+int failures = 0;
+
+void expectNear(const std::string &what, double actual, double expected) {
+  if (std::fabs(actual - expected) > 1e-9 * std::max(1.0, std::fabs(expected))) {
+    std::cerr << what << ": got " << actual << ", expected " << expected
+              << std::endl;
+    failures++;
+  }
+}
+
+int main() {
+  std::string path = "/tmp/progress_check_" + std::to_string(getpid()) + ".db";
+  const std::vector<std::string> phonemes = {"th", "dh", "r", "l", "ih", "iy"};
+  // user -> assessments to add; covers fewer than, exactly, and several
+  // times kRecentWindow.
+  const std::map<std::string, int> plan = {
+      {"one", 1},
+      {"few", 3},
+      {"window", Database::kRecentWindow},
+      {"many", Database::kRecentWindow * 2 + 3}};
+
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<double> score(20, 100);
+  std::vector<AssessmentRecord> all;
+  std::map<std::string, int> remaining = plan;
+  int64_t at = 1700000000;
+  for (bool more = true; more;) {
+    more = false;
+    for (auto &[user, left] : remaining) {
+      if (left == 0) {
+        continue;
+      }
+      left--;
+      more = true;
+      AssessmentRecord r;
+      r.username = user;
+      r.referenceText = "morning morning.";
+      r.accuracy = score(rng);
+      r.fluency = score(rng);
+      r.completeness = score(rng);
+      r.prosody = score(rng);
+      r.pronunciation = score(rng);
+      r.wordCount = 2;
+      r.createdAt = at++;
+      // "th" only shows up every fourth assessment, so it stays below
+      // kMinPhonemeSamples for the smaller users.
+      for (size_t p = 0; p < phonemes.size(); p++) {
+        if (p == 0 && all.size() % 4 != 0) {
+          continue;
+        }
+        r.phonemes.push_back({phonemes[p], score(rng)});
+      }
+      all.push_back(r);
+    }
+  }
+
+  {
+    Database db{path};
+    // Uneven batch sizes so a user's records are split across transactions
+    // and sometimes appear several times in one.
+    const size_t sizes[] = {1, 4, 2, 7, 3, 11};
+    size_t begin = 0;
+    for (size_t b = 0; begin < all.size(); b++) {
+      size_t end = std::min(all.size(), begin + sizes[b % 6]);
+      db.addAssessments({all.begin() + begin, all.begin() + end});
+      begin = end;
+    }
+  }
+
+  Database db{path};
+  sqlite3 *raw;
+  sqlite3_open(path.c_str(), &raw);
+  for (const auto &[user, count] : plan) {
+    UserProgress progress = db.getProgress(user);
+
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(
+        raw,
+        "SELECT count(*), avg(accuracy), avg(fluency), avg(completeness), "
+        "avg(prosody), avg(pronunciation), max(created_at), "
+        "(SELECT avg(pronunciation) FROM (SELECT pronunciation FROM "
+        "assessments WHERE username = ?1 ORDER BY id DESC LIMIT ?2)) "
+        "FROM assessments WHERE username = ?1",
+        -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, Database::kRecentWindow);
+    sqlite3_step(stmt);
+    expectNear(user + " count", progress.count, sqlite3_column_int64(stmt, 0));
+    expectNear(user + " count vs plan", progress.count, count);
+    expectNear(user + " accuracy", progress.accuracy,
+               sqlite3_column_double(stmt, 1));
+    expectNear(user + " fluency", progress.fluency,
+               sqlite3_column_double(stmt, 2));
+    expectNear(user + " completeness", progress.completeness,
+               sqlite3_column_double(stmt, 3));
+    expectNear(user + " prosody", progress.prosody,
+               sqlite3_column_double(stmt, 4));
+    expectNear(user + " pronunciation", progress.pronunciation,
+               sqlite3_column_double(stmt, 5));
+    expectNear(user + " lastAssessedAt", progress.lastAssessedAt,
+               sqlite3_column_int64(stmt, 6));
+    expectNear(user + " recentPronunciation", progress.recentPronunciation,
+               sqlite3_column_double(stmt, 7));
+    sqlite3_finalize(stmt);
+
+    std::map<std::string, std::pair<int, double>> perPhoneme;
+    for (const AssessmentRecord &r : all) {
+      if (r.username != user) {
+        continue;
+      }
+      for (const PhonemeScore &p : r.phonemes) {
+        perPhoneme[p.phoneme].first++;
+        perPhoneme[p.phoneme].second += p.accuracy;
+      }
+    }
+    std::vector<PhonemeScore> expected;
+    for (const auto &[phoneme, stats] : perPhoneme) {
+      if (stats.first >= Database::kMinPhonemeSamples) {
+        expected.push_back({phoneme, stats.second / stats.first});
+      }
+    }
+    std::sort(expected.begin(), expected.end(),
+              [](const PhonemeScore &a, const PhonemeScore &b) {
+                return a.accuracy < b.accuracy;
+              });
+    expected.resize(std::min<size_t>(expected.size(),
+                                     Database::kWeakestPhonemes));
+
+    if (progress.weakestPhonemes.size() != expected.size()) {
+      std::cerr << user << " weakestPhonemes: got "
+                << progress.weakestPhonemes.size() << ", expected "
+                << expected.size() << std::endl;
+      failures++;
+      continue;
+    }
+    for (size_t i = 0; i < expected.size(); i++) {
+      if (progress.weakestPhonemes[i].phoneme != expected[i].phoneme) {
+        std::cerr << user << " weakest #" << i << ": got "
+                  << progress.weakestPhonemes[i].phoneme << ", expected "
+                  << expected[i].phoneme << std::endl;
+        failures++;
+      }
+      expectNear(user + " " + expected[i].phoneme + " average",
+                 progress.weakestPhonemes[i].accuracy, expected[i].accuracy);
+    }
+  }
+  expectNear("unknown user count", db.getProgress("nobody").count, 0);
+
+  sqlite3_close(raw);
+  for (const char *suffix : {"", "-wal", "-shm"}) {
+    std::remove((path + suffix).c_str());
+  }
+  std::cout << (failures ? "FAILED" : "OK") << ": " << all.size()
+            << " assessments, " << plan.size() << " users" << std::endl;
+  return failures ? 1 : 0;
+}
@@ -1,25 +1,18 @@
+#include "Assessment.h"
+#include "BatchPipeline.h"
+#include "Database.h"
+#include "Speech.h"
 #include "env.h"
-#include <chrono>
-#include <condition_variable>
-#include <crow.h>
 #include <cstdlib>
 #include <cstring>
-#include <ctime>
 #include <curl/curl.h>
 #include <filesystem>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
 #include <iterator>
-#include <nlohmann/json.hpp>
-#include <queue>
-#include <random>
-#include <sstream>
-#include <thread>
+#include <string>
 #include <vector>
 
-using json = nlohmann::json;
-
 const std::string subscriptionKey =
     SUBSCRIPTION_KEY;                // <-- Insert your subscription key
 const std::string region = "eastus"; // <-- e.g., "eastus"
@@ -28,85 +21,87 @@ const std::string audioFilePath = "meow.pcm";
 const std::string referenceText = "morning morning.";
 const size_t chunkSize = 1024;
 
-std::vector<uint8_t> waveHeader16K16BitMono = {
-    82, 73, 70, 70, 78, 128, 0,   0,  87,  65, 86, 69, 102, 109, 116, 32,
-    18, 0,  0,  0,  1,  0,   1,   0,  128, 62, 0,  0,  0,   125, 0,   0,
-    2,  0,  16, 0,  0,  0,   100, 97, 116, 97, 0,  0,  0,   0};
-
-struct PronunciationAssessmentParams {
-  std::string GradingSystem = "HundredMark";
-  std::string Dimension = "Comprehensive";
-  std::string ReferenceText = referenceText;
-  std::string EnableProsodyAssessment = "true";
-  std::string PhonemeAlphabet = "SAPI";
-  std::string EnableMiscue = "true";
-  std::string NBestPhonemeCount = "5";
-
-  std::string toBase64Json() const {
-    json j = {{"GradingSystem", GradingSystem},
-              {"Dimension", Dimension},
-              {"ReferenceText", ReferenceText},
-              {"EnableProsodyAssessment", EnableProsodyAssessment},
-              {"PhonemeAlphabet", PhonemeAlphabet},
-              {"EnableMiscue", EnableMiscue},
-              {"NBestPhonemeCount", NBestPhonemeCount}};
-
-    std::string jsonStr = j.dump();
-    std::string encoded;
-    CURL *curl = curl_easy_init();
-    if (curl) {
-      char *output = curl_easy_escape(curl, jsonStr.c_str(), jsonStr.length());
-      if (output) {
-        encoded = output;
-        curl_free(output);
-      }
-      curl_easy_cleanup(curl);
+// pronoun --batch manifest.tsv [--name name] [--db file] [--uploads N]
+//         [--workers N]
+// Grades every recording in the manifest (audio<TAB>reference<TAB>username).
+// Finished items are recorded in the database under the run's name, the
+// manifest's absolute path by default, and skipped when it is run again.
+int runBatch(int argc, char **argv) {
+  std::string manifest = argv[2];
+  std::string name =
+      std::filesystem::absolute(manifest).lexically_normal().string();
+  std::string dbPath = "auth.db";
+  batch::Options options;
+  options.region = region;
+  options.locale = locale;
+  options.subscriptionKey = subscriptionKey;
+  for (int i = 3; i < argc; i += 2) {
+    std::string flag = argv[i];
+    if (i + 1 == argc) {
+      std::cerr << "Missing value for " << flag << std::endl;
+      return 1;
+    }
+    if (flag == "--name") {
+      name = argv[i + 1];
+    } else if (flag == "--db") {
+      dbPath = argv[i + 1];
+    } else if (flag == "--uploads") {
+      options.uploads = std::atoi(argv[i + 1]);
+    } else if (flag == "--workers") {
+      options.workers = std::atoi(argv[i + 1]);
+    } else {
+      std::cerr << "Unknown option: " << flag << std::endl;
+      return 1;
     }
-    return encoded;
   }
-};
 
-std::string generateSessionID() {
-  std::ostringstream oss;
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_int_distribution<uint64_t> dis;
-  oss << std::hex << dis(gen);
-  return oss.str();
-}
-
-struct MemoryStream {
-  std::ifstream file;
-  std::vector<uint8_t> header;
-  size_t chunkSize;
-
-  MemoryStream(const std::string &path, const std::vector<uint8_t> &header,
-               size_t chunkSize)
-      : file(path, std::ios::binary), header(header), chunkSize(chunkSize) {}
+  batch::Report report;
+  try {
+    Database db{dbPath};
+    batch::Pipeline pipeline(batch::loadManifest(manifest), db, name, options);
+    report = pipeline.run();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
 
-  static size_t readCallback(void *ptr, size_t size, size_t nmemb,
-                             void *userp) {
-    MemoryStream *stream = static_cast<MemoryStream *>(userp);
-    static bool headerSent = false;
-    if (!headerSent) {
-      memcpy(ptr, stream->header.data(), stream->header.size());
-      headerSent = true;
-      return stream->header.size();
-    }
+  std::cout << "Graded " << report.graded << " of " << report.items
+            << " items (" << report.skipped << " already done, "
+            << report.failed << " failed) in " << report.wallSeconds
+            << " s with " << report.workers << " workers: "
+            << report.itemsPerMinute() << " items/min" << std::endl;
+  for (int s = 0; s < batch::kStageCount; s++) {
+    const batch::StageStats &stage = report.stages[s];
+    std::cout << "  " << batch::stageName(s) << ": " << stage.runs
+              << " runs, "
+              << (stage.runs ? stage.busyMs / stage.runs : 0.0)
+              << " ms mean" << std::endl;
+  }
+  return report.failed ? 1 : 0;
+}
 
-    if (!stream->file.is_open() || stream->file.eof()) {
-      return 0;
+int main(int argc, char **argv) {
+  if (argc > 1 && std::strcmp(argv[1], "--batch") == 0) {
+    if (argc < 3 || argv[2][0] == '-') {
+      std::cerr << "Usage: " << argv[0]
+                << " --batch manifest.tsv [--name name] [--db file] "
+                   "[--uploads N] [--workers N]"
+                << std::endl;
+      return 1;
     }
-
-    stream->file.read(reinterpret_cast<char *>(ptr), size * nmemb);
-    std::this_thread::sleep_for(std::chrono::milliseconds(
-        stream->chunkSize * 1000 / 32000)); // simulate streaming
-    return stream->file.gcount();
+    curl_global_init(CURL_GLOBAL_ALL);
+    trace::initFromEnv();
+    int status = runBatch(argc, argv);
+    curl_global_cleanup();
+    trace::dumpToEnvFile();
+    return status;
   }
-};
 
-int main() {
+  // Results are only persisted when we know whose recording this is.
+  const std::string username = argc > 1 ? argv[1] : "";
+
   curl_global_init(CURL_GLOBAL_ALL);
+  trace::initFromEnv();
 
   // Open audio stream
   if (!std::filesystem::exists(audioFilePath)) {
@@ -114,77 +109,74 @@ int main() {
     return 1;
   }
 
-  PronunciationAssessmentParams params;
-  std::string paramsBase64 = params.toBase64Json();
-  std::string sessionID = generateSessionID();
-
-  std::string url = "https://" + region +
-                    ".stt.speech.microsoft.com/speech/recognition/conversation/"
-                    "cognitiveservices/v1?format=detailed&language=" +
-                    locale + "&X-ConnectionId=" + sessionID;
-
-  CURL *curl = curl_easy_init();
-  if (!curl) {
-    std::cerr << "Curl init failed" << std::endl;
-    return 1;
-  }
-
-  MemoryStream stream(audioFilePath, waveHeader16K16BitMono, chunkSize);
-
-  struct curl_slist *headers = nullptr;
-  headers = curl_slist_append(headers, "Accept: application/json;text/xml");
-  headers = curl_slist_append(headers, "Connection: Keep-Alive");
-  headers = curl_slist_append(
-      headers, "Content-Type: audio/wav; codecs=audio/pcm; samplerate=16000");
-  headers = curl_slist_append(
-      headers, ("Ocp-Apim-Subscription-Key: " + subscriptionKey).c_str());
-  headers = curl_slist_append(
-      headers, ("Pronunciation-Assessment: " + paramsBase64).c_str());
-  headers = curl_slist_append(headers, "Transfer-Encoding: chunked");
-  headers = curl_slist_append(headers, "Expect: 100-continue");
-
-  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-  curl_easy_setopt(curl, CURLOPT_POST, 1L);
-  curl_easy_setopt(curl, CURLOPT_READFUNCTION, MemoryStream::readCallback);
-  curl_easy_setopt(curl, CURLOPT_READDATA, &stream);
-  curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
-
-  auto start = std::chrono::high_resolution_clock::now();
-
-  std::string responseData;
-  curl_easy_setopt(
-      curl, CURLOPT_WRITEFUNCTION,
-      +[](void *contents, size_t size, size_t nmemb, std::string *s) -> size_t {
-        size_t totalSize = size * nmemb;
-        s->append((char *)contents, totalSize);
-        return totalSize;
-      });
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &responseData);
-
-  CURLcode res = curl_easy_perform(curl);
-  auto end = std::chrono::high_resolution_clock::now();
-
-  if (res != CURLE_OK) {
-    std::cerr << "Request failed: " << curl_easy_strerror(res) << std::endl;
-  } else {
-    long httpCode;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
-    std::cout << "Session ID: " << sessionID << std::endl;
-    if (httpCode != 200) {
-      std::cerr << "HTTP " << httpCode << ": " << responseData << std::endl;
+  std::ifstream file(audioFilePath, std::ios::binary);
+  std::vector<uint8_t> audio = waveHeader16K16BitMono;
+  audio.insert(audio.end(), std::istreambuf_iterator<char>(file),
+               std::istreambuf_iterator<char>());
+
+  {
+    TRACE_REQUEST("pronoun.session");
+    PronunciationAssessmentParams params;
+    params.ReferenceText = referenceText;
+    std::string sessionID = speech::generateSessionID();
+    std::string url = speech::sttUrl(region, locale, sessionID);
+
+    // simulate streaming from a microphone
+    speech::AudioUpload upload{.data = audio.data(),
+                               .size = audio.size(),
+                               .chunkSize = chunkSize,
+                               .realtime = true};
+    speech::Response response = speech::assess(
+        url, subscriptionKey, params, upload, UpstreamPolicy::fromEnv());
+    const UpstreamResult &call = response.call;
+
+    if (call.rejected) {
+      std::cerr << "Request skipped: " << Upstream::endpointKey(url)
+                << " is failing, circuit open" << std::endl;
+    } else if (call.code != CURLE_OK) {
+      std::cerr << "Request failed: " << curl_easy_strerror(call.code)
+                << std::endl;
     } else {
-      std::cout << "Response: " << responseData << std::endl;
-      auto latency =
-          std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
-              .count();
-      std::cout << "Latency: " << latency << " ms" << std::endl;
+      std::cout << "Session ID: " << sessionID << std::endl;
+      if (call.httpCode != 200) {
+        std::cerr << "HTTP " << call.httpCode << ": " << response.body
+                  << std::endl;
+      } else {
+        AssessmentResult result;
+        if (!assessment::parse(response.body, result)) {
+          std::cerr << "Malformed response: " << response.body << std::endl;
+        } else {
+          std::cout << "Status: " << result.recognitionStatus << std::endl;
+          std::cout << "Accuracy: " << result.accuracy
+                    << " Fluency: " << result.fluency
+                    << " Completeness: " << result.completeness
+                    << " Prosody: " << result.prosody
+                    << " Pronunciation: " << result.pronunciation << std::endl;
+          for (const WordAssessment &word : result.words) {
+            std::cout << "  " << word.word << " @" << word.offset / 10000
+                      << "ms: " << word.accuracy << " (" << word.errorType
+                      << ")" << std::endl;
+          }
+
+          if (!username.empty()) {
+            try {
+              Database db{"auth.db"};
+              db.addAssessments(
+                  {assessment::toRecord(result, username, referenceText)});
+            } catch (const std::exception &e) {
+              std::cerr << "Failed to save assessment: " << e.what()
+                        << std::endl;
+            }
+          }
+        }
+        std::cout << "Latency: " << static_cast<long>(call.totalMs) << " ms"
+                  << std::endl;
+      }
     }
   }
 
-  curl_easy_cleanup(curl);
-  curl_slist_free_all(headers);
   curl_global_cleanup();
+  trace::dumpToEnvFile();
 
   return 0;
 }
@@ -0,0 +1,228 @@
+// Heap bytes requested by each thread, to attribute memory to sessions
+// without counting the in-process server.
+#define BENCH_COUNT_ALLOCATIONS
+
+#include "Assessment.h"
+#include "Bench.h"
+#include "Speech.h"
+#include "UpstreamSim.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <curl/curl.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+// Drives simulated learners through the whole speech path (upload, scoring,
+// result parsing) against a local stand-in for the STT endpoint and prints
+// latency, throughput and per-session cost as JSON.
+
+using json = nlohmann::json;
+
+std::string readFile(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("File not found: " + path);
+  }
+  return {std::istreambuf_iterator<char>(file),
+          std::istreambuf_iterator<char>()};
+}
+
+double cpuMs(const rusage &r) {
+  return r.ru_utime.tv_sec * 1e3 + r.ru_utime.tv_usec / 1e3 +
+         r.ru_stime.tv_sec * 1e3 + r.ru_stime.tv_usec / 1e3;
+}
+
+struct Session {
+  bool ok = false;
+  double ttfbMs = 0;
+  double totalMs = 0;
+  double parseMs = 0;
+  double cpuMs = 0;
+  size_t allocatedBytes = 0;
+};
+
+json summarize(std::vector<double> v) {
+  if (v.empty()) {
+    return json::object();
+  }
+  std::sort(v.begin(), v.end());
+  auto at = [&](double p) { return v[static_cast<size_t>(p * (v.size() - 1))]; };
+  double sum = 0;
+  for (double x : v) {
+    sum += x;
+  }
+  return {{"mean", sum / v.size()}, {"p50", at(0.50)}, {"p90", at(0.90)},
+          {"p99", at(0.99)},        {"max", v.back()}};
+}
+
+int main(int argc, char **argv) {
+  auto flags = bench::parseFlags(argc, argv);
+  auto number = [&](const char *name, double fallback) {
+    auto it = flags.find(name);
+    return it == flags.end() ? fallback : std::atof(it->second.c_str());
+  };
+  auto text = [&](const char *name, const std::string &fallback) {
+    auto it = flags.find(name);
+    return it == flags.end() ? fallback : it->second;
+  };
+
+  int learners = static_cast<int>(number("learners", 16));
+  int sessions = static_cast<int>(number("sessions", 10));
+  bool realtime = number("realtime", 0) != 0;
+  size_t uploadChunk = static_cast<size_t>(number("upload-chunk", 1024));
+  std::string fixture = text("fixture", "fixtures/assessment_read_aloud.json");
+  std::string audioPath = text("audio", "meow.pcm");
+
+  std::vector<uint8_t> audio = waveHeader16K16BitMono;
+  try {
+    std::string pcm = readFile(audioPath);
+    audio.insert(audio.end(), pcm.begin(), pcm.end());
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  SimBehaviour b;
+  b.latencyMs = number("latency", 50);
+  b.jitterMs = number("jitter", 10);
+  b.latencyPerAudioSecondMs = number("per-audio-second", 0);
+  b.responseChunkBytes = static_cast<size_t>(number("chunk-bytes", 0));
+  b.chunkDelayMs = number("chunk-delay", 0);
+
+  // --endpoint benchmarks an already running server (e.g. upstream_sim)
+  // instead of the in-process one.
+  std::string endpoint = text("endpoint", "");
+  if (endpoint.empty()) {
+    try {
+      b.assessmentBody = std::make_shared<const std::string>(readFile(fixture));
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  curl_global_init(CURL_GLOBAL_ALL);
+
+  std::unique_ptr<UpstreamSim> sim;
+  if (endpoint.empty()) {
+    sim = std::make_unique<UpstreamSim>(b);
+    sim->start();
+    endpoint = sim->baseUrl();
+  }
+
+  PronunciationAssessmentParams params;
+  params.ReferenceText = "morning morning.";
+  UpstreamPolicy policy = UpstreamPolicy::fromEnv();
+
+  std::vector<std::vector<Session>> results(learners);
+  std::vector<std::thread> threads;
+  auto wallStart = std::chrono::steady_clock::now();
+
+  for (int l = 0; l < learners; l++) {
+    threads.emplace_back([&, l] {
+      AssessmentResult parsed;
+      for (int i = 0; i < sessions; i++) {
+        Session s;
+        rusage before, after;
+        getrusage(RUSAGE_THREAD, &before);
+        size_t allocatedBefore = bench::threadAllocations.bytes;
+
+        std::string url = endpoint +
+                          "/speech/recognition/conversation/cognitiveservices/"
+                          "v1?format=detailed&language=en-US&X-ConnectionId=" +
+                          speech::generateSessionID();
+        speech::AudioUpload upload{.data = audio.data(),
+                                   .size = audio.size(),
+                                   .chunkSize = uploadChunk,
+                                   .realtime = realtime};
+        speech::Response response =
+            speech::assess(url, "local", params, upload, policy);
+
+        auto parseStart = std::chrono::steady_clock::now();
+        s.ok = response.call.ok() && assessment::parse(response.body, parsed) &&
+               !parsed.words.empty();
+        s.parseMs = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - parseStart)
+                        .count();
+
+        getrusage(RUSAGE_THREAD, &after);
+        s.ttfbMs = response.firstByteMs;
+        s.totalMs = response.call.totalMs + s.parseMs;
+        s.cpuMs = cpuMs(after) - cpuMs(before);
+        s.allocatedBytes = bench::threadAllocations.bytes - allocatedBefore;
+        results[l].push_back(s);
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  double wallSeconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - wallStart)
+                           .count();
+
+  std::vector<double> ttfb, total, parse, cpu, allocated;
+  size_t failed = 0;
+  for (const auto &perLearner : results) {
+    for (const Session &s : perLearner) {
+      if (!s.ok) {
+        failed++;
+        continue;
+      }
+      ttfb.push_back(s.ttfbMs);
+      total.push_back(s.totalMs);
+      parse.push_back(s.parseMs);
+      cpu.push_back(s.cpuMs);
+      allocated.push_back(static_cast<double>(s.allocatedBytes));
+    }
+  }
+
+  rusage self;
+  getrusage(RUSAGE_SELF, &self);
+
+  json config = {{"learners", learners},
+                 {"sessionsPerLearner", sessions},
+                 {"realtimeUpload", realtime},
+                 {"uploadChunkBytes", uploadChunk},
+                 {"audioBytes", audio.size()},
+                 {"endpoint", endpoint},
+                 {"inProcessServer", sim != nullptr}};
+  // The simulator knobs mean nothing for an external server.
+  if (sim) {
+    config["responseBytes"] = b.assessmentBody->size();
+    config["latencyMs"] = b.latencyMs;
+    config["jitterMs"] = b.jitterMs;
+    config["perAudioSecondMs"] = b.latencyPerAudioSecondMs;
+    config["chunkBytes"] = b.responseChunkBytes;
+    config["chunkDelayMs"] = b.chunkDelayMs;
+  }
+
+  json report = {
+      {"config", config},
+      {"sessions", learners * sessions},
+      {"failed", failed},
+      {"wallSeconds", wallSeconds},
+      {"sessionsPerSecond", (learners * sessions - failed) / wallSeconds},
+      {"ttfbMs", summarize(ttfb)},
+      {"totalMs", summarize(total)},
+      {"parseMs", summarize(parse)},
+      {"cpuMsPerSession", summarize(cpu)},
+      {"heapBytesPerSession", summarize(allocated)},
+      {"peakRssKb", self.ru_maxrss}};
+  std::cout << report.dump(2) << std::endl;
+
+  if (sim) {
+    sim->stop();
+  }
+  curl_global_cleanup();
+  return failed ? 1 : 0;
+}
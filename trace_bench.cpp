@@ -0,0 +1,107 @@
+#include "Bench.h"
+#include "Database.h"
+#include "JWT.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+// Runs the instrumented signup validation and login path (JSON parse, regex
+// checks, SQLite lookup, password hashing) in a loop and prints the mean cost
+// per request as JSON, along with the cost of a root and one span around no
+// work. bench_trace.sh compares a build with the tracing macros compiled out
+// against this one at different sample rates.
+
+using json = nlohmann::json;
+
+bool handleLogin(Database &db, const std::string &body) {
+  TRACE_REQUEST("auth.login");
+  json request = [&] {
+    TRACE_SPAN("json.parse");
+    return json::parse(body);
+  }();
+  std::string username = request["username"];
+  std::string email = request["email"];
+  if (!auth_utils::is_valid_username(username) ||
+      !auth_utils::is_valid_email(email) || !db.userExists(username)) {
+    return false;
+  }
+  User user = db.getUser(username);
+  return auth_utils::hash_password(request["password"], user.salt) ==
+         user.password_hash;
+}
+
+int main(int argc, char **argv) {
+  auto flags = bench::parseFlags(argc, argv);
+  auto number = [&](const char *name, double fallback) {
+    auto it = flags.find(name);
+    return it == flags.end() ? fallback : std::atof(it->second.c_str());
+  };
+
+  int requests = static_cast<int>(number("requests", 20000));
+  int rounds = static_cast<int>(number("rounds", 5));
+  trace::setSampleRate(number("rate", 0));
+
+  std::string path = "/tmp/trace_bench_" + std::to_string(getpid()) + ".db";
+  double bestNs = 0;
+  bool ok = true;
+  {
+    Database db{path};
+    std::string salt = auth_utils::generate_salt();
+    db.addUser({"learner", auth_utils::hash_password("Passw0rd!", salt), salt,
+                "learner@example.com"});
+    std::string body = json{{"username", "learner"},
+                            {"password", "Passw0rd!"},
+                            {"email", "learner@example.com"}}
+                           .dump();
+
+    // The fastest round is the least disturbed by the rest of the machine.
+    for (int r = 0; r < rounds; r++) {
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < requests; i++) {
+        ok &= handleLogin(db, body);
+      }
+      double ns = std::chrono::duration<double, std::nano>(
+                      std::chrono::steady_clock::now() - start)
+                      .count() /
+                  requests;
+      bestNs = r == 0 ? ns : std::min(bestNs, ns);
+    }
+  }
+  std::remove(path.c_str());
+  for (const char *suffix : {"-wal", "-shm"}) {
+    std::remove((path + suffix).c_str());
+  }
+
+  // The same instrumentation around no work, which isolates its own cost.
+  const int empty = 1000000;
+  auto emptyStart = std::chrono::steady_clock::now();
+  for (int i = 0; i < empty; i++) {
+    TRACE_REQUEST("noop");
+    TRACE_SPAN("noop.child");
+    asm volatile("" ::: "memory");
+  }
+  double emptyNs = std::chrono::duration<double, std::nano>(
+                       std::chrono::steady_clock::now() - emptyStart)
+                       .count() /
+                   empty;
+
+#ifdef PTE_TRACE_DISABLED
+  bool compiled = false;
+#else
+  bool compiled = true;
+#endif
+  json report = {{"tracingCompiledIn", compiled},
+                 {"sampleRate", trace::sampleRate()},
+                 {"requestsPerRound", requests},
+                 {"rounds", rounds},
+                 {"nsPerRequest", bestNs},
+                 {"nsPerEmptyRequest", emptyNs}};
+  std::cout << report.dump() << std::endl;
+  return ok ? 0 : 1;
+}
@@ -1,19 +1,10 @@
+#include "Speech.h"
 #include "env.h"
 #include <curl/curl.h>
 #include <fstream>
 #include <iostream>
 #include <string>
 
-#include "env.h"
-
-// Callback to write the audio data to a file
-size_t writeData(void *ptr, size_t size, size_t nmemb, void *userdata) {
-  std::ofstream *out = static_cast<std::ofstream *>(userdata);
-  size_t totalSize = size * nmemb;
-  out->write(static_cast<char *>(ptr), totalSize);
-  return totalSize;
-}
-
 int main() {
 
   std::string content = "my voice is my passport verify me";
@@ -25,45 +16,34 @@ int main() {
                      "</voice>"
                      "</speak>";
 
-  CURL *curl = curl_easy_init();
-  if (!curl) {
-    std::cerr << "Failed to initialize curl\n";
-    return 1;
-  }
-
-  struct curl_slist *headers = nullptr;
-  headers = curl_slist_append(
-      headers, ("Ocp-Apim-Subscription-Key: " + SUBSCRIPTION_KEY).data());
-
-  headers = curl_slist_append(headers, "Content-Type: application/ssml+xml");
-  headers = curl_slist_append(
-      headers, "X-Microsoft-OutputFormat: audio-16khz-128kbitrate-mono-mp3");
-  headers = curl_slist_append(headers, "User-Agent: curl");
-
-  std::ofstream outfile("output.mp3", std::ios::binary);
-  if (!outfile) {
-    std::cerr << "Failed to open output file\n";
-    return 1;
-  }
+  curl_global_init(CURL_GLOBAL_ALL);
 
-  curl_easy_setopt(curl, CURLOPT_URL, URL.data());
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-  curl_easy_setopt(curl, CURLOPT_POST, 1L);
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, ssml.c_str());
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, ssml.size());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeData);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &outfile);
+  std::string url = speech::endpoint("TTS_ENDPOINT", URL);
+  speech::Response response = speech::synthesize(
+      url, SUBSCRIPTION_KEY, ssml, UpstreamPolicy::fromEnv());
+  const UpstreamResult &call = response.call;
 
-  CURLcode res = curl_easy_perform(curl);
-  if (res != CURLE_OK) {
-    std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res)
+  int status = 1;
+  if (call.rejected) {
+    std::cerr << "Request skipped: " << Upstream::endpointKey(url)
+              << " is failing, circuit open\n";
+  } else if (call.code != CURLE_OK) {
+    std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(call.code)
               << "\n";
+  } else if (!call.ok()) {
+    std::cerr << "HTTP " << call.httpCode << "\n";
   } else {
-    std::cout << "Audio saved to output.mp3\n";
+    std::ofstream outfile("output.mp3", std::ios::binary);
+    if (!outfile) {
+      std::cerr << "Failed to open output file\n";
+    } else {
+      outfile.write(response.body.data(), response.body.size());
+      std::cout << "Audio saved to output.mp3"
+                << (call.hedged ? " (hedged)" : "") << "\n";
+      status = 0;
+    }
   }
 
-  curl_slist_free_all(headers);
-  curl_easy_cleanup(curl);
-  outfile.close();
-  return 0;
+  curl_global_cleanup();
+  return status;
 }
@@ -0,0 +1,64 @@
+#include "Bench.h"
+#include "UpstreamSim.h"
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+// Standalone stand-in for the Azure STT and TTS endpoints. Run it, then point
+// pronoun/tts at it with STT_ENDPOINT / TTS_ENDPOINT=http://127.0.0.1:<port>.
+
+int main(int argc, char **argv) {
+  auto flags = bench::parseFlags(argc, argv);
+  auto number = [&](const char *name, double fallback) {
+    auto it = flags.find(name);
+    return it == flags.end() ? fallback : std::atof(it->second.c_str());
+  };
+
+  std::string fixture =
+      flags.count("fixture") ? flags["fixture"] : "fixtures/assessment_short.json";
+  std::ifstream file(fixture, std::ios::binary);
+  if (!file) {
+    std::cerr << "Fixture not found: " << fixture << std::endl;
+    return 1;
+  }
+
+  SimBehaviour b;
+  b.latencyMs = number("latency", 50);
+  b.jitterMs = number("jitter", 10);
+  b.stragglerRate = number("straggler-rate", 0);
+  b.stragglerMs = number("straggler-ms", 1000);
+  b.failureRate = number("failure-rate", 0);
+  b.audioBytes = static_cast<size_t>(number("audio-bytes", 16 * 1024));
+  b.latencyPerAudioSecondMs = number("per-audio-second", 0);
+  b.responseChunkBytes = static_cast<size_t>(number("chunk-bytes", 0));
+  b.chunkDelayMs = number("chunk-delay", 0);
+  b.assessmentBody = std::make_shared<const std::string>(
+      std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+  // Block the shutdown signals before any thread starts so only sigwait
+  // below sees them.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  UpstreamSim sim(b);
+  try {
+    sim.start(static_cast<uint16_t>(number("port", 8090)));
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  std::cout << "Listening on " << sim.baseUrl() << std::endl;
+
+  int sig;
+  sigwait(&signals, &sig);
+  std::cout << "Served " << sim.requests() << " requests" << std::endl;
+  sim.stop();
+  return 0;
+}